@@ -3,7 +3,11 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/iosched.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block
@@ -16,6 +20,8 @@ struct block
 
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
+    struct iosched sched;               /* Requests waiting, if the driver
+                                           has a start operation. */
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
@@ -28,6 +34,10 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, block_sector_t, void *,
+                      block_sector_t cnt, bool write);
+static void transfer_now (struct block *, struct block_request *);
+static block_complete_func wake_up;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -48,6 +58,45 @@ block_type_name (enum block_type type)
   return block_type_names[type];
 }
 
+/* Returns a human-readable name for the given request
+   CLASS. */
+const char *
+block_class_name (enum block_class class)
+{
+  static const char *block_class_names[BLOCK_CLASS_CNT] =
+    {
+      "fault",
+      "sync",
+      "background",
+    };
+
+  ASSERT (class < BLOCK_CLASS_CNT);
+  return block_class_names[class];
+}
+
+/* Makes CLASS the class of the requests that the running thread
+   makes with block_read(), block_write() and the like from now
+   on, and returns the class that it replaces.  A thread's class
+   starts out as BLOCK_CLASS_SYNC.
+
+   The page fault handler raises its class to BLOCK_CLASS_FAULT
+   while it evicts a page to make room and reads in the new one,
+   so that the faulting process does not have to wait behind every
+   other read and write that happens to be queued for the same
+   disk.  Threads that write back data that nobody is waiting
+   for, such as the buffer cache flusher and the page cleaner,
+   lower their class to BLOCK_CLASS_BACKGROUND. */
+enum block_class
+block_set_class (enum block_class class)
+{
+  struct thread *t = thread_current ();
+  enum block_class old_class = t->io_class;
+
+  ASSERT (class < BLOCK_CLASS_CNT);
+  t->io_class = class;
+  return old_class;
+}
+
 /* Returns the block device fulfilling the given ROLE, or a null
    pointer if no block device has been assigned that role. */
 struct block *
@@ -99,20 +148,6 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
-static void
-check_sector (struct block *block, block_sector_t sector)
-{
-  if (sector >= block->size)
-    {
-      /* We do not use ASSERT because we want to panic here
-         regardless of whether NDEBUG is defined. */
-      PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
-    }
-}
-
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +155,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer (block, sector, buffer, 1, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +166,128 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer (block, sector, (void *) buffer, 1, true);
+}
+
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, block_sector_t cnt)
+{
+  ASSERT (cnt > 0);
+
+  /* We do not use ASSERT because we want to panic here
+     regardless of whether NDEBUG is defined. */
+  if (sector >= block->size || cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%"PRDSNu", "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt, block->size);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it transfer all of the sectors
+   with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, block_sector_t cnt)
+{
+  transfer (block, sector, buffer, cnt, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  Drivers that support it transfer all of the
+   sectors with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, block_sector_t cnt)
+{
+  transfer (block, sector, (void *) buffer, cnt, true);
+}
+
+/* Starts transferring REQUEST->cnt sectors starting at
+   REQUEST->sector between BLOCK and REQUEST->buffer, writing to
+   BLOCK if REQUEST->write is true and reading from it otherwise,
+   and returns without waiting for the transfer to finish.
+   REQUEST->complete is called with REQUEST once it has
+   finished.  Until then, REQUEST belongs to the block layer, and
+   must not be modified or freed.
+
+   COMPLETE may be called from an interrupt handler, so it must
+   not sleep, or before block_submit() returns, if BLOCK's driver
+   can only transfer data synchronously.  By the time it is
+   called, REQUEST->sector and REQUEST->block may have been
+   translated to refer to an underlying device, as they are for
+   partitions.
+
+   Requests may be carried out in any order, but those of a more
+   urgent REQUEST->class tend to be carried out first.  Internally
+   synchronizes accesses to block devices, so external per-block
+   device locking is unneeded. */
+void
+block_submit (struct block *block, struct block_request *request)
+{
+  check_sectors (block, request->sector, request->cnt);
+  ASSERT (!request->write || block->type != BLOCK_FOREIGN);
+  ASSERT (request->class < BLOCK_CLASS_CNT);
+  ASSERT (request->complete != NULL);
+
+  request->block = block;
+  request->done_cnt = 0;
+  if (request->write)
+    block->write_cnt += request->cnt;
+  else
+    block->read_cnt += request->cnt;
+
+  if (block->ops->start != NULL)
+    {
+      enum intr_level old_level = intr_disable ();
+      iosched_add (&block->sched, request);
+      block->ops->start (block->aux);
+      intr_set_level (old_level);
+    }
+  else if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, request);
+  else
+    {
+      transfer_now (block, request);
+      request->complete (request);
+    }
+}
+
+/* Removes the request that BLOCK's I/O scheduler says to carry
+   out next from BLOCK's queue and returns it, or returns a null
+   pointer if no requests are waiting.  The request may be the
+   first of a chain of requests for consecutive sectors, all in
+   the same direction, linked through their merge_next members,
+   which the driver should carry out together.
+   For use by drivers with a start operation.  Must be called
+   with interrupts off. */
+struct block_request *
+block_next_request (struct block *block) 
+{
+  ASSERT (block->ops->start != NULL);
+  return iosched_next (&block->sched);
+}
+
+/* Reports that the driver has finished carrying out REQUEST,
+   obtained from block_next_request(), and every request merged
+   with it. */
+void
+block_complete (struct block_request *request) 
+{
+  while (request != NULL)
+    {
+      /* REQUEST may be freed as soon as it is completed. */
+      struct block_request *next = request->merge_next;
+      request->complete (request);
+      request = next;
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +311,12 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints statistics for each block device used for a Pintos
+   role, and for the I/O scheduler of each device that has one. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -176,6 +329,23 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      const struct iosched *q = &block->sched;
+      enum block_class class;
+
+      if (block->ops->start == NULL)
+        continue;
+      printf ("%s: %s I/O scheduler, %llu dispatched (",
+              block->name, iosched_name (q), q->dispatch_cnt);
+      for (class = 0; class < BLOCK_CLASS_CNT; class++)
+        printf ("%s%llu %s", class > 0 ? ", " : "",
+                q->class_cnt[class], block_class_name (class));
+      printf ("), %llu merged, %llu overdue\n", q->merge_cnt, q->overdue_cnt);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -198,6 +368,7 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
+  iosched_init (&block->sched);
   block->read_cnt = 0;
   block->write_cnt = 0;
 
@@ -211,6 +382,63 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, writing to BLOCK if WRITE is true and reading from it
+   otherwise, and waits for the transfer to finish. */
+static void
+transfer (struct block *block, block_sector_t sector, void *buffer,
+          block_sector_t cnt, bool write)
+{
+  struct block_request request;
+  struct semaphore done;
+
+  ASSERT (!intr_context ());
+
+  sema_init (&done, 0);
+  request.write = write;
+  request.class = thread_current ()->io_class;
+  request.sector = sector;
+  request.cnt = cnt;
+  request.buffer = buffer;
+  request.complete = wake_up;
+  request.aux = &done;
+  block_submit (block, &request);
+  sema_down (&done);
+}
+
+/* Completion function for transfer(). */
+static void
+wake_up (struct block_request *request)
+{
+  sema_up (request->aux);
+}
+
+/* Carries out REQUEST on BLOCK, whose driver has no submit
+   function, using its synchronous functions instead. */
+static void
+transfer_now (struct block *block, struct block_request *request)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *buffer = request->buffer;
+  block_sector_t i;
+
+  if (request->write && ops->write_multiple != NULL)
+    ops->write_multiple (block->aux, request->sector, buffer, request->cnt);
+  else if (!request->write && ops->read_multiple != NULL)
+    ops->read_multiple (block->aux, request->sector, buffer, request->cnt);
+  else
+    for (i = 0; i < request->cnt; i++)
+      {
+        block_sector_t sector = request->sector + i;
+        uint8_t *sector_buffer = buffer + i * BLOCK_SECTOR_SIZE;
+        if (request->write)
+          ops->write (block->aux, sector, sector_buffer);
+        else
+          ops->read (block->aux, sector, sector_buffer);
+      }
+  request->done_cnt = request->cnt;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
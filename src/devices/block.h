@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,6 +55,56 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *,
+                          block_sector_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           block_sector_t cnt);
+
+/* Classes of requests, most urgent first.  I/O schedulers serve
+   waiting requests of a more urgent class first, unless a request
+   of a less urgent class has waited too long. */
+enum block_class
+  {
+    BLOCK_CLASS_FAULT,          /* Request a page fault waits for. */
+    BLOCK_CLASS_SYNC,           /* Other request a thread waits for. */
+    BLOCK_CLASS_BACKGROUND,     /* Write-back and read-ahead that
+                                   nobody waits for. */
+    BLOCK_CLASS_CNT             /* Number of classes. */
+  };
+
+const char *block_class_name (enum block_class);
+enum block_class block_set_class (enum block_class);
+
+/* Asynchronous requests. */
+struct block_request;
+typedef void block_complete_func (struct block_request *);
+
+/* A request to transfer CNT consecutive sectors between a block
+   device and memory without waiting for the transfer to finish.
+   See block_submit(). */
+struct block_request
+  {
+    /* Filled in by the submitter. */
+    bool write;                         /* Write to device? */
+    enum block_class class;             /* How urgent it is. */
+    block_sector_t sector;              /* First sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_complete_func *complete;      /* Called when done. */
+    void *aux;                          /* For COMPLETE's use. */
+
+    /* Owned by the block layer and the driver until COMPLETE is
+       called. */
+    struct block *block;                /* Device being accessed. */
+    struct list_elem elem;              /* Element in an I/O scheduler. */
+    struct list_elem fifo_elem;         /* Element in arrival order. */
+    int64_t deadline;                   /* When it has waited too long. */
+    struct block_request *merge_next;   /* Request for the sectors that
+                                           follow, merged into this one. */
+    block_sector_t done_cnt;            /* Sectors transferred so far. */
+  };
+
+void block_submit (struct block *, struct block_request *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -65,10 +117,35 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors in a single request.
+       Optional: if null, the block layer falls back to CNT calls
+       to READ or WRITE. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           block_sector_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            block_sector_t cnt);
+
+    /* Starts carrying out REQUEST and returns, calling
+       REQUEST->complete once it is done, possibly from an
+       interrupt handler.  Optional: if null, the block layer
+       carries out requests itself with the functions above, and
+       a driver that provides it need not provide those. */
+    void (*submit) (void *aux, struct block_request *request);
+
+    /* Tells the driver that there are requests waiting in the
+       device's I/O scheduler.  The driver takes them with
+       block_next_request() whenever it is ready for more, and
+       passes each back to block_complete() once it is done.
+       Called with interrupts off.  Optional: a driver that
+       provides it need not provide any of the functions above. */
+    void (*start) (void *aux);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+struct block_request *block_next_request (struct block *);
+void block_complete (struct block_request *);
 
 #endif /* devices/block.h */
@@ -5,13 +5,22 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the controller can act as a PCI bus master, as the PIIX
+   controllers emulated by QEMU and Bochs can, sectors are moved
+   by DMA, so that the CPU is free to run other threads while a
+   transfer is in progress.  Otherwise, and for buffers that DMA
+   can't reach, the CPU moves each sector itself with programmed
+   I/O (PIO). */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +39,28 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to the channel's
+   bm_base, as in the "Programming Interface for Bus Master IDE
+   Controller" specification. */
+#define bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)    /* Command. */
+#define bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)     /* Status. */
+#define bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)       /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  ERR and IRQ are cleared by
+   writing 1 to them. */
+#define BM_STA_ACTIVE 0x01      /* Transfer in progress. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_IRQ 0x04         /* Disk has interrupted. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +76,33 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Largest number of sectors a single READ SECTOR or WRITE SECTOR
+   command can transfer.  The sector count register is 8 bits
+   wide and a count of 0 means 256 sectors. */
+#define MAX_SECTORS_PER_CMD 256
+
+/* Physical region descriptor, one entry in the table that tells
+   a bus master channel which memory to transfer to or from.  A
+   region must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of region. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* Last entry in the table. */
+#define PRD_BOUNDARY 0x10000    /* Regions may not cross multiples. */
+
+/* Number of entries in a channel's PRD table.  A transfer of
+   MAX_SECTORS_PER_CMD sectors from a buffer that is contiguous in
+   physical memory, as kernel buffers are, needs at most 3, but a
+   chain of merged requests needs at least one per request.  A
+   command covers only as many sectors as fit. */
+#define PRD_CNT 8
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +111,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer data by DMA? */
+    struct block *block;        /* Block device, once registered. */
   };
 
 /* An ATA channel (aka controller).
@@ -65,14 +121,28 @@ struct channel
   {
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
+    uint16_t bm_base;           /* Bus master I/O port, 0 if none. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
-    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct semaphore completion_wait;   /* Up'd by interrupt handler when no
+                                           request is in progress. */
+
+    /* Request chain in progress, taken from one of the disks'
+       I/O schedulers.  Only touched with interrupts off. */
+    struct block_request *current;  /* First request, null if idle. */
+    struct block_request *cursor;   /* Request being transferred. */
+    struct ata_disk *disk;      /* Disk that CURRENT is for. */
+    int next_dev;               /* Disk to look for requests on first. */
+    bool dma;                   /* Is the current command using DMA? */
+    block_sector_t cmd_left;    /* Sectors left in current command. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    /* PRD table for DMA.  Aligned to its own size, so that it
+       doesn't cross a 64 kB boundary either. */
+    struct prd prdt[PRD_CNT] __attribute__ ((aligned (PRD_CNT * 8)));
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -81,17 +151,27 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void select_sectors (struct ata_disk *, block_sector_t,
+                            block_sector_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void start_request (struct channel *);
+static void start_command (struct channel *);
+static void continue_command (struct channel *, uint8_t status);
+static void advance (struct channel *, block_sector_t cnt);
+static block_sector_t prepare_prdt (struct channel *, block_sector_t max);
+static bool add_region (struct channel *, size_t *prd_cnt,
+                        uintptr_t phys, size_t size);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool wait_for_drq (struct channel *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
@@ -101,6 +181,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +204,12 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->current = c->cursor = NULL;
+      c->disk = NULL;
+      c->next_dev = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +220,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
+          d->block = NULL;
         }
 
       /* Register interrupt handler. */
@@ -159,6 +245,33 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Looks on the PCI bus for an IDE controller that can do bus
+   master DMA for the legacy channels.  If there is one, enables
+   it as a bus master and returns the base of its bus master
+   ports, otherwise returns 0. */
+static uint16_t
+find_bus_master (void) 
+{
+  struct pci_dev dev;
+  uint16_t bm_base;
+
+  /* Bit 7 of the programming interface says that the controller
+     is a bus master; bits 0 and 2 would say that a channel has
+     been moved from its legacy ports, which we don't handle. */
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &dev)
+      || (dev.prog_if & 0x80) == 0
+      || (dev.prog_if & 0x05) != 0)
+    return 0;
+
+  bm_base = pci_io_bar (&dev, 4);
+  if (bm_base == 0)
+    return 0;
+
+  pci_enable_bus_master (&dev);
+  printf ("ide: bus master DMA at port 0x%04"PRIx16"\n", bm_base);
+  return bm_base;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -270,9 +383,11 @@ identify_ata_device (struct ata_disk *d)
 
   /* Send the IDENTIFY DEVICE command, wait for an interrupt
      indicating the device's response is ready, and read the data
-     into our buffer. */
+     into our buffer.  Interrupts must be enabled or our semaphore
+     will never be up'd by the completion handler. */
+  ASSERT (intr_get_level () == INTR_ON);
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -282,12 +397,15 @@ identify_ata_device (struct ata_disk *d)
   input_sector (c, id);
 
   /* Calculate capacity.
+     Check for DMA support (word 49, bit 8).
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->use_dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->use_dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -306,6 +424,7 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  d->block = block;
   partition_scan (block);
 }
 
@@ -337,63 +456,50 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Tells disk D that requests are waiting in its I/O scheduler,
+   starting on them at once if D's channel is idle.  The channel's
+   interrupt handler then carries out waiting requests for both
+   of its disks, one chain of merged requests after another,
+   calling each request's completion function when it is done, so
+   nobody has to wait for the disk unless they want to.
+   Each group of up to MAX_SECTORS_PER_CMD sectors in a chain is
+   transferred by a single READ DMA or WRITE DMA command, which
+   interrupts once at the end, or failing that by a READ SECTOR or
+   WRITE SECTOR command, which interrupts once per sector. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_start (void *d_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
-}
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
-{
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  if (c->current == NULL)
+    start_request (c);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ide_start
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between 1
+   and MAX_SECTORS_PER_CMD, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,12 +510,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
-  /* Interrupts must be enabled or our semaphore will never be
-     up'd by the completion handler. */
-  ASSERT (intr_get_level () == INTR_ON);
-
   c->expecting_interrupt = true;
   outb (reg_command (c), command);
 }
@@ -430,13 +532,261 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Returns the part of REQUEST's buffer that has not been
+   transferred yet. */
+static uint8_t *
+request_buffer (struct block_request *request) 
+{
+  return (uint8_t *) request->buffer + request->done_cnt * BLOCK_SECTOR_SIZE;
+}
+
+/* Takes the next request chain for one of channel C's disks
+   and starts on it, taking turns between the disks so that
+   neither starves the other.  Leaves C idle if no requests are
+   waiting.  C must be idle and interrupts must be off. */
+static void
+start_request (struct channel *c) 
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->current == NULL);
+
+  for (i = 0; i < 2; i++)
+    {
+      struct ata_disk *d = &c->devices[(c->next_dev + i) % 2];
+      struct block_request *r;
+
+      if (d->block == NULL)
+        continue;
+      r = block_next_request (d->block);
+      if (r != NULL)
+        {
+          c->current = c->cursor = r;
+          c->disk = d;
+          c->next_dev = (d->dev_no + 1) % 2;
+          start_command (c);
+          return;
+        }
+    }
+}
+
+/* Starts a command on channel C to transfer as much of the rest
+   of C's current request chain, from the cursor on, as a single
+   command can, by DMA if possible.  Interrupts must be off. */
+static void
+start_command (struct channel *c) 
+{
+  struct block_request *r = c->cursor;
+  struct ata_disk *d = c->disk;
+  block_sector_t sec_no = r->sector + r->done_cnt;
+  block_sector_t left = 0;
+  block_sector_t cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (; r != NULL && left < MAX_SECTORS_PER_CMD; r = r->merge_next)
+    left += r->cnt - r->done_cnt;
+  if (left > MAX_SECTORS_PER_CMD)
+    left = MAX_SECTORS_PER_CMD;
+  r = c->cursor;
+
+  cnt = d->use_dma ? prepare_prdt (c, left) : 0;
+  c->dma = cnt > 0;
+  c->cmd_left = c->dma ? cnt : left;
+  if (c->dma)
+    {
+      uint8_t direction = r->write ? 0 : BM_CMD_READ;
+
+      outl (bm_prdt (c), vtop (c->prdt));
+      outb (bm_command (c), direction);
+      outb (bm_status (c), BM_STA_ERR | BM_STA_IRQ);
+      select_sectors (d, sec_no, c->cmd_left);
+      issue_command (c, r->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (bm_command (c), direction | BM_CMD_START);
+    }
+  else
+    {
+      select_sectors (d, sec_no, c->cmd_left);
+      issue_command (c, (r->write
+                         ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY));
+
+      /* The disk doesn't interrupt until it has the first sector
+         of a write. */
+      if (r->write)
+        {
+          if (!wait_for_drq (c))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no);
+          output_sector (c, request_buffer (r));
+        }
+    }
+}
+
+/* Carries on with channel C's current request chain after the
+   disk has interrupted with the given STATUS.  Once the chain is
+   done, starts on the next one and calls the completion function
+   of each request in the chain. */
+static void
+continue_command (struct channel *c, uint8_t status) 
+{
+  struct block_request *r = c->cursor;
+  struct block_request *done;
+  struct ata_disk *d = c->disk;
+  const char *what = r->write ? "write" : "read";
+
+  if (c->dma)
+    {
+      uint8_t bm_sta;
+
+      /* Stop the channel and check how the transfer went. */
+      outb (bm_command (c), r->write ? 0 : BM_CMD_READ);
+      bm_sta = inb (bm_status (c));
+      outb (bm_status (c), BM_STA_ERR | BM_STA_IRQ);
+      if ((bm_sta & (BM_STA_ERR | BM_STA_ACTIVE)) || (status & STA_ERR))
+        PANIC ("%s: DMA %s failed, sector=%"PRDSNu,
+               d->name, what, r->sector + r->done_cnt);
+      advance (c, c->cmd_left);
+      c->cmd_left = 0;
+    }
+  else
+    {
+      /* A read interrupts when a sector is ready to be read, a
+         write when the disk has taken a sector, and is then ready
+         for the next one if there is one. */
+      bool more = r->write ? c->cmd_left > 1 : true;
+      if ((status & STA_ERR) || (more && !(status & STA_DRQ)))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, what, r->sector + r->done_cnt);
+      if (!r->write)
+        input_sector (c, request_buffer (r));
+      advance (c, 1);
+      c->cmd_left--;
+      if (r->write && c->cmd_left > 0)
+        output_sector (c, request_buffer (c->cursor));
+    }
+
+  if (c->cmd_left > 0)
+    return;
+  if (c->cursor != NULL)
+    {
+      start_command (c);
+      return;
+    }
+
+  /* Start the next chain before completing this one, in case a
+     completion function submits another request. */
+  done = c->current;
+  c->current = NULL;
+  start_request (c);
+  block_complete (done);
+}
+
+/* Records that CNT more sectors of channel C's current request
+   chain have been transferred, moving the cursor on to the next
+   request in the chain as each one is finished, or to a null
+   pointer at the end of the chain. */
+static void
+advance (struct channel *c, block_sector_t cnt) 
+{
+  while (cnt > 0)
+    {
+      struct block_request *r = c->cursor;
+      block_sector_t left = r->cnt - r->done_cnt;
+      block_sector_t step = cnt < left ? cnt : left;
+
+      r->done_cnt += step;
+      cnt -= step;
+      if (r->done_cnt == r->cnt)
+        c->cursor = r->merge_next;
+    }
+}
+
+/* Fills in C's PRD table to describe the buffers for up to MAX
+   sectors of C's current request chain, from the cursor on.
+   Returns the number of sectors described, which is 0 if the
+   first buffer is not in kernel memory, which is the only memory
+   whose physical address we can easily find, or is not suitably
+   aligned.  Stops early at such a buffer, or when the table is
+   full. */
+static block_sector_t
+prepare_prdt (struct channel *c, block_sector_t max) 
+{
+  struct block_request *r;
+  block_sector_t cnt = 0;
+  size_t prd_cnt = 0;
+
+  for (r = c->cursor; r != NULL && cnt < max; r = r->merge_next)
+    {
+      block_sector_t i;
+
+      if (!is_kernel_vaddr (r->buffer) || (uintptr_t) r->buffer % 2 != 0)
+        break;
+      for (i = r->done_cnt; i < r->cnt && cnt < max; i++, cnt++)
+        {
+          /* Add the sector whole or not at all. */
+          size_t old_prd_cnt = prd_cnt;
+          uint16_t old_size = prd_cnt > 0 ? c->prdt[prd_cnt - 1].size : 0;
+          uint8_t *sector = (uint8_t *) r->buffer + i * BLOCK_SECTOR_SIZE;
+
+          if (!add_region (c, &prd_cnt, vtop (sector), BLOCK_SECTOR_SIZE))
+            {
+              prd_cnt = old_prd_cnt;
+              if (prd_cnt > 0)
+                c->prdt[prd_cnt - 1].size = old_size;
+              goto done;
+            }
+        }
+    }
+
+ done:
+  if (prd_cnt > 0)
+    c->prdt[prd_cnt - 1].flags = PRD_EOT;
+  return cnt;
+}
+
+/* Adds the SIZE bytes at physical address PHYS to the *PRD_CNT
+   entries of C's PRD table, extending the last entry if PHYS
+   follows on from it, and updates *PRD_CNT.  Returns false if
+   the table runs out of entries. */
+static bool
+add_region (struct channel *c, size_t *prd_cnt, uintptr_t phys, size_t size) 
+{
+  while (size > 0)
+    {
+      struct prd *last = *prd_cnt > 0 ? &c->prdt[*prd_cnt - 1] : NULL;
+      size_t region = PRD_BOUNDARY - phys % PRD_BOUNDARY;
+      if (region > size)
+        region = size;
+
+      /* An entry that ends on a boundary is full, even if its
+         size reads as 0. */
+      if (last != NULL && phys % PRD_BOUNDARY != 0
+          && last->addr + last->size == phys)
+        last->size += region;
+      else
+        {
+          if (*prd_cnt >= PRD_CNT)
+            return false;
+          c->prdt[*prd_cnt].addr = phys;
+          c->prdt[*prd_cnt].size = region;  /* 64 kB truncates to 0. */
+          c->prdt[*prd_cnt].flags = 0;
+          ++*prd_cnt;
+        }
+      phys += region;
+      size -= region;
+    }
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
    is, for the BSY and DRQ bits to clear in the status register.
 
    As a side effect, reading the status register clears any
-   pending interrupt. */
+   pending interrupt.  Busy-waits, so that it may be called with
+   interrupts off when a command is started. */
 static void
 wait_until_idle (const struct ata_disk *d) 
 {
@@ -446,7 +796,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +829,30 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Busy-waits for the disk selected on channel C to ask for the
+   data for a write command, which it should do almost at once.
+   Unlike wait_while_busy(), uses busy-waiting delays rather than
+   sleeping, so it may be called with interrupts off.
+   Returns false if the disk reports an error or takes longer
+   than about a second. */
+static bool
+wait_for_drq (struct channel *c) 
+{
+  int i;
+
+  timer_ndelay (400);
+  for (i = 0; i < 100000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (status & STA_ERR)
+        return false;
+      if (!(status & STA_BSY) && (status & STA_DRQ))
+        return true;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +863,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -513,8 +887,11 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            uint8_t status = inb (reg_status (c)); /* Acknowledge interrupt. */
+            if (c->current != NULL)
+              continue_command (c, status);
+            else
+              sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
           printf ("%s: unexpected interrupt\n", c->name);
@@ -0,0 +1,290 @@
+#include "devices/iosched.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* Largest request chain built by merging, in sectors. */
+#define MERGE_MAX 128
+
+/* Timer ticks that a request of each class may wait before it
+   is served ahead of more urgent classes and, under the deadline
+   policy, ahead of the sweep: 20 ms for page fault reads, 50 ms
+   for other reads and 500 ms for background requests. */
+static const int64_t expire[BLOCK_CLASS_CNT] =
+  {
+    TIMER_FREQ / 50,
+    TIMER_FREQ / 20,
+    TIMER_FREQ / 2,
+  };
+
+/* An I/O scheduling policy. */
+struct iosched_type
+  {
+    const char *name;                   /* Name on the command line. */
+
+    /* Adds request R to Q's queue for R's class. */
+    void (*add) (struct iosched *q, struct block_request *r);
+
+    /* Returns the request in Q's queue for CLASS to dispatch
+       next, without removing it.  That queue is not empty. */
+    struct block_request *(*choose) (struct iosched *q,
+                                     enum block_class class);
+  };
+
+static void fifo_add (struct iosched *, struct block_request *);
+static struct block_request *fifo_choose (struct iosched *,
+                                          enum block_class);
+static void sorted_add (struct iosched *, struct block_request *);
+static struct block_request *clook_choose (struct iosched *,
+                                           enum block_class);
+static struct block_request *deadline_choose (struct iosched *,
+                                              enum block_class);
+
+/* Available policies.
+   "noop" serves requests in the order they arrive.
+   "clook" sweeps across the disk in increasing sector order,
+   then jumps back to the lowest waiting sector and sweeps again.
+   "deadline" is like "clook", but serves the oldest request of a
+   class first once it has waited too long, to bound latency.
+   Each policy orders each class of requests separately. */
+static const struct iosched_type types[] =
+  {
+    {"noop", fifo_add, fifo_choose},
+    {"clook", sorted_add, clook_choose},
+    {"deadline", sorted_add, deadline_choose},
+  };
+#define TYPE_CNT (sizeof types / sizeof *types)
+
+/* Policy given to new I/O schedulers. */
+static const struct iosched_type *default_type = &types[1];
+
+static enum block_class choose_class (struct iosched *, bool *overdue);
+static struct block_request *oldest_request (struct iosched *,
+                                             enum block_class);
+static struct block_request *request_of (struct list_elem *);
+static void remove_request (struct block_request *);
+
+/* Makes the policy named NAME the one used by I/O schedulers
+   initialized from now on.  Returns true if successful, false if
+   there is no such policy. */
+bool
+iosched_set_default (const char *name) 
+{
+  size_t i;
+
+  if (name != NULL)
+    for (i = 0; i < TYPE_CNT; i++)
+      if (!strcmp (name, types[i].name))
+        {
+          default_type = &types[i];
+          return true;
+        }
+  return false;
+}
+
+/* Initializes Q as an empty queue with the default policy. */
+void
+iosched_init (struct iosched *q) 
+{
+  enum block_class class;
+
+  q->type = default_type;
+  for (class = 0; class < BLOCK_CLASS_CNT; class++)
+    {
+      list_init (&q->queue[class]);
+      list_init (&q->fifo[class]);
+      q->class_cnt[class] = 0;
+    }
+  q->head = 0;
+  q->dispatch_cnt = 0;
+  q->merge_cnt = 0;
+  q->overdue_cnt = 0;
+}
+
+/* Adds R to Q.  Interrupts must be off. */
+void
+iosched_add (struct iosched *q, struct block_request *r) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  r->deadline = timer_ticks () + expire[r->class];
+  r->merge_next = NULL;
+  list_push_back (&q->fifo[r->class], &r->fifo_elem);
+  q->type->add (q, r);
+}
+
+/* Chooses the class to serve next and removes the request that
+   Q's policy says to serve next in that class from Q, and returns
+   it, along with any requests for the sectors that follow it in
+   the same direction and class, linked through their merge_next
+   members.  Returns a null pointer if Q is empty.
+   Interrupts must be off. */
+struct block_request *
+iosched_next (struct iosched *q) 
+{
+  struct block_request *first, *last;
+  enum block_class class;
+  struct list *queue;
+  struct list_elem *e;
+  block_sector_t cnt;
+  bool overdue;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  class = choose_class (q, &overdue);
+  if (class == BLOCK_CLASS_CNT)
+    return NULL;
+  queue = &q->queue[class];
+
+  first = last = q->type->choose (q, class);
+  cnt = first->cnt;
+  e = list_next (&first->elem);
+  remove_request (first);
+
+  /* Merge the requests that follow on, for as long as they are
+     next to each other in the queue. */
+  while (e != list_end (queue))
+    {
+      struct block_request *r = request_of (e);
+      if (r->write != first->write
+          || r->sector != last->sector + last->cnt
+          || cnt + r->cnt > MERGE_MAX)
+        break;
+
+      e = list_next (e);
+      remove_request (r);
+      last->merge_next = r;
+      last = r;
+      cnt += r->cnt;
+      q->merge_cnt++;
+    }
+
+  q->head = last->sector + last->cnt;
+  q->dispatch_cnt++;
+  q->class_cnt[class]++;
+  if (overdue)
+    q->overdue_cnt++;
+  return first;
+}
+
+/* Returns the name of Q's policy. */
+const char *
+iosched_name (const struct iosched *q) 
+{
+  return q->type->name;
+}
+
+/* Returns the class of request that Q should serve next: the
+   class whose oldest request is most overdue, if any is, or
+   otherwise the most urgent class with requests waiting.  Sets
+   *OVERDUE to true if that is not the most urgent class with
+   requests waiting.  Returns BLOCK_CLASS_CNT if Q is empty. */
+static enum block_class
+choose_class (struct iosched *q, bool *overdue) 
+{
+  int64_t now = timer_ticks ();
+  enum block_class urgent = BLOCK_CLASS_CNT;
+  enum block_class late = BLOCK_CLASS_CNT;
+  int64_t late_deadline = 0;
+  enum block_class class;
+
+  for (class = 0; class < BLOCK_CLASS_CNT; class++)
+    if (!list_empty (&q->fifo[class]))
+      {
+        int64_t deadline = oldest_request (q, class)->deadline;
+        if (urgent == BLOCK_CLASS_CNT)
+          urgent = class;
+        if (deadline <= now
+            && (late == BLOCK_CLASS_CNT || deadline < late_deadline))
+          {
+            late = class;
+            late_deadline = deadline;
+          }
+      }
+
+  *overdue = late != BLOCK_CLASS_CNT && late != urgent;
+  return late != BLOCK_CLASS_CNT ? late : urgent;
+}
+
+/* Adds R to the end of Q's queue for its class. */
+static void
+fifo_add (struct iosched *q, struct block_request *r) 
+{
+  list_push_back (&q->queue[r->class], &r->elem);
+}
+
+/* Returns the request at the front of Q's queue for CLASS. */
+static struct block_request *
+fifo_choose (struct iosched *q, enum block_class class) 
+{
+  return request_of (list_front (&q->queue[class]));
+}
+
+/* Returns true if request A starts before request B. */
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* Adds R to Q's queue for its class in order of sector, after
+   any requests for the same sector. */
+static void
+sorted_add (struct iosched *q, struct block_request *r) 
+{
+  list_insert_ordered (&q->queue[r->class], &r->elem, sector_less, NULL);
+}
+
+/* Returns the first request in Q's queue for CLASS at or after
+   the head, or the first request if there is none. */
+static struct block_request *
+clook_choose (struct iosched *q, enum block_class class) 
+{
+  struct list *queue = &q->queue[class];
+  struct list_elem *e;
+
+  for (e = list_begin (queue); e != list_end (queue); e = list_next (e))
+    if (request_of (e)->sector >= q->head)
+      return request_of (e);
+  return request_of (list_front (queue));
+}
+
+/* Returns the oldest request of CLASS in Q if it has waited too
+   long, or failing that the request that clook_choose() would. */
+static struct block_request *
+deadline_choose (struct iosched *q, enum block_class class) 
+{
+  struct block_request *r = oldest_request (q, class);
+
+  if (timer_ticks () >= r->deadline)
+    return r;
+  return clook_choose (q, class);
+}
+
+/* Returns the request of CLASS that has waited longest in Q,
+   which must have at least one. */
+static struct block_request *
+oldest_request (struct iosched *q, enum block_class class) 
+{
+  return list_entry (list_front (&q->fifo[class]),
+                     struct block_request, fifo_elem);
+}
+
+/* Returns the request that contains queue element E. */
+static struct block_request *
+request_of (struct list_elem *e) 
+{
+  return list_entry (e, struct block_request, elem);
+}
+
+/* Removes R from its I/O scheduler. */
+static void
+remove_request (struct block_request *r) 
+{
+  list_remove (&r->elem);
+  list_remove (&r->fifo_elem);
+}
@@ -0,0 +1,51 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* I/O scheduler.
+
+   Each block device whose driver takes requests from a queue has
+   an I/O scheduler, which holds the requests waiting for the
+   device and decides which one it should carry out next.  Runs of
+   waiting requests for adjacent sectors are merged into a single
+   request chain, so that the driver can transfer them with a
+   single command.
+
+   Each class of request (see enum block_class) waits in a queue
+   of its own.  The scheduler serves the most urgent class that
+   has requests waiting, but once the oldest request of any class
+   has waited longer than its class allows, it serves the class
+   whose oldest request is most overdue first, so that no class
+   starves. */
+
+/* A queue of requests and the policy that orders it. */
+struct iosched
+  {
+    const struct iosched_type *type;    /* Policy. */
+    struct list queue[BLOCK_CLASS_CNT]; /* Waiting requests of each
+                                           class, ordered as TYPE
+                                           requires. */
+    struct list fifo[BLOCK_CLASS_CNT];  /* The same, in order of
+                                           arrival. */
+    block_sector_t head;                /* Sector following the last
+                                           request dispatched. */
+
+    /* Statistics. */
+    unsigned long long dispatch_cnt;    /* Request chains dispatched. */
+    unsigned long long class_cnt[BLOCK_CLASS_CNT];  /* Of each class. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long overdue_cnt;     /* Chains dispatched ahead of a
+                                           more urgent class because they
+                                           had waited too long. */
+  };
+
+bool iosched_set_default (const char *name);
+void iosched_init (struct iosched *);
+void iosched_add (struct iosched *, struct block_request *);
+struct block_request *iosched_next (struct iosched *);
+const char *iosched_name (const struct iosched *);
+
+#endif /* devices/iosched.h */
@@ -0,0 +1,179 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* This code is a minimal interface to PCI configuration space,
+   using configuration mechanism #1 from the PCI Local Bus
+   Specification.  It only does what drivers need to find their
+   controllers: there is no resource assignment, since the BIOS
+   has already done that. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8 /* Selects bus/slot/func/register. */
+#define PCI_CONFIG_DATA 0xcfc    /* Contains the selected register. */
+
+/* Enable bit in PCI_CONFIG_ADDRESS. */
+#define PCI_CONFIG_ENABLE 0x80000000
+
+#define PCI_BUS_CNT 256         /* Buses per system. */
+#define PCI_SLOT_CNT 32         /* Devices per bus. */
+#define PCI_FUNC_CNT 8          /* Functions per device. */
+
+/* Header type bit meaning that a device has more than one
+   function. */
+#define PCI_HEADER_MULTIFUNC 0x80
+
+static bool find (bool (*match) (const struct pci_dev *, const void *aux),
+                  const void *aux, int skip, struct pci_dev *);
+static bool match_class (const struct pci_dev *, const void *aux);
+static bool match_id (const struct pci_dev *, const void *aux);
+static void select_register (int bus, int slot, int func, uint8_t reg);
+static uint32_t read_config (int bus, int slot, int func, uint8_t reg);
+
+/* Searches the PCI buses for the first function whose class and
+   subclass codes are CLASS and SUBCLASS.  If one is found, fills
+   in *DEV and returns true; otherwise returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *dev) 
+{
+  const uint8_t codes[2] = {class, subclass};
+  return find (match_class, codes, 0, dev);
+}
+
+/* Searches the PCI buses for functions whose vendor and device
+   IDs are VENDOR_ID and DEVICE_ID, skipping the first SKIP of
+   them.  If one is found, fills in *DEV and returns true;
+   otherwise returns false.  Call with SKIP = 0, 1, 2, ... to
+   find every such function. */
+bool
+pci_find_device (uint16_t vendor_id, uint16_t device_id, int skip,
+                 struct pci_dev *dev) 
+{
+  const uint16_t ids[2] = {vendor_id, device_id};
+  return find (match_id, ids, skip, dev);
+}
+
+/* Returns the 32-bit configuration register REG of DEV.
+   REG must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_dev *dev, uint8_t reg) 
+{
+  return read_config (dev->bus, dev->slot, dev->func, reg);
+}
+
+/* Sets the 32-bit configuration register REG of DEV to VALUE.
+   REG must be a multiple of 4. */
+void
+pci_write_config (const struct pci_dev *dev, uint8_t reg, uint32_t value) 
+{
+  select_register (dev->bus, dev->slot, dev->func, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns the I/O port base address in DEV's base address
+   register BAR, or 0 if BAR is not an I/O space BAR. */
+uint16_t
+pci_io_bar (const struct pci_dev *dev, int bar) 
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+
+  value = pci_read_config (dev, PCI_REG_BAR0 + bar * 4);
+  return value & 1 ? value & ~3u : 0;
+}
+
+/* Allows DEV to access memory on its own, as DMA requires, and
+   to respond to its I/O ports. */
+void
+pci_enable_bus_master (const struct pci_dev *dev) 
+{
+  uint32_t command = pci_read_config (dev, PCI_REG_COMMAND);
+  pci_write_config (dev, PCI_REG_COMMAND,
+                    (command & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER);
+}
+
+/* Searches the PCI buses in order for functions for which MATCH
+   returns true when passed the function and AUX, skipping the
+   first SKIP of them.  If one is found, fills in *DEV and returns
+   true; otherwise returns false. */
+static bool
+find (bool (*match) (const struct pci_dev *, const void *aux),
+      const void *aux, int skip, struct pci_dev *dev) 
+{
+  int bus, slot, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (slot = 0; slot < PCI_SLOT_CNT; slot++)
+      for (func = 0; func < PCI_FUNC_CNT; func++)
+        {
+          uint32_t id = read_config (bus, slot, func, PCI_REG_ID);
+          uint32_t class_reg;
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is missing, so is
+                 the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class_reg = read_config (bus, slot, func, PCI_REG_CLASS);
+          dev->bus = bus;
+          dev->slot = slot;
+          dev->func = func;
+          dev->vendor_id = id & 0xffff;
+          dev->device_id = id >> 16;
+          dev->class = class_reg >> 24;
+          dev->subclass = (class_reg >> 16) & 0xff;
+          dev->prog_if = (class_reg >> 8) & 0xff;
+          if (match (dev, aux) && skip-- == 0)
+            return true;
+
+          /* Functions other than 0 only exist on multifunction
+             devices. */
+          if (func == 0
+              && !((read_config (bus, slot, 0, PCI_REG_HEADER) >> 16)
+                   & PCI_HEADER_MULTIFUNC))
+            break;
+        }
+  return false;
+}
+
+/* Returns true if DEV's class and subclass codes are the two
+   bytes in AUX. */
+static bool
+match_class (const struct pci_dev *dev, const void *aux) 
+{
+  const uint8_t *codes = aux;
+  return dev->class == codes[0] && dev->subclass == codes[1];
+}
+
+/* Returns true if DEV's vendor and device IDs are the two
+   16-bit values in AUX. */
+static bool
+match_id (const struct pci_dev *dev, const void *aux) 
+{
+  const uint16_t *ids = aux;
+  return dev->vendor_id == ids[0] && dev->device_id == ids[1];
+}
+
+/* Makes configuration register REG of function FUNC of device
+   SLOT on bus BUS accessible through PCI_CONFIG_DATA. */
+static void
+select_register (int bus, int slot, int func, uint8_t reg) 
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDRESS, (PCI_CONFIG_ENABLE | (bus << 16) | (slot << 11)
+                             | (func << 8) | reg));
+}
+
+/* Returns configuration register REG of function FUNC of device
+   SLOT on bus BUS. */
+static uint32_t
+read_config (int bus, int slot, int func, uint8_t reg) 
+{
+  select_register (bus, slot, func, reg);
+  return inl (PCI_CONFIG_DATA);
+}
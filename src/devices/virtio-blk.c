@@ -0,0 +1,456 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for virtio block devices, as
+   offered by QEMU with "-drive if=virtio".  It uses the legacy
+   PCI interface of the Virtual I/O Device (VIRTIO) specification,
+   version 1.0, section 4.1.4.8, which all versions of QEMU
+   provide.
+
+   A virtio disk takes requests from a ring in memory, the
+   virtqueue.  Each request is a chain of descriptors that
+   describes a header, any number of data buffers and a status
+   byte, and the device moves the data by DMA and interrupts when
+   it is done.  Unlike an IDE channel, the device works on many
+   requests at once, so we hand it several request chains from
+   the block layer's I/O scheduler at a time. */
+
+/* PCI IDs of a (transitional) virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio register port addresses, relative to the I/O
+   space in base address register 0. */
+#define reg_device_features(DISK) ((DISK)->io_base + 0x00)   /* 32 bits. */
+#define reg_guest_features(DISK) ((DISK)->io_base + 0x04)    /* 32 bits. */
+#define reg_queue_pfn(DISK) ((DISK)->io_base + 0x08)         /* 32 bits. */
+#define reg_queue_size(DISK) ((DISK)->io_base + 0x0c)        /* 16 bits. */
+#define reg_queue_select(DISK) ((DISK)->io_base + 0x0e)      /* 16 bits. */
+#define reg_queue_notify(DISK) ((DISK)->io_base + 0x10)      /* 16 bits. */
+#define reg_status(DISK) ((DISK)->io_base + 0x12)            /* 8 bits. */
+#define reg_isr(DISK) ((DISK)->io_base + 0x13)               /* 8 bits. */
+#define reg_capacity(DISK) ((DISK)->io_base + 0x14)          /* 64 bits. */
+
+/* Device Status register bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver has given up on it. */
+
+/* ISR Status register bits.  Reading the register clears them. */
+#define ISR_QUEUE 0x01          /* Used ring has been updated. */
+
+/* Alignment of the used ring within a legacy virtqueue, which is
+   also the unit of the queue's address. */
+#define QUEUE_ALIGN 4096
+
+/* Descriptor in a virtqueue's descriptor table. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Buffer size in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, with F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 0x1   /* Chain continues with NEXT. */
+#define VRING_DESC_F_WRITE 0x2  /* Device writes, not reads, buffer. */
+
+/* Ring of descriptor chains made available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;             /* Always 0: we want interrupts. */
+    uint16_t idx;               /* Where we put the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* Entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of descriptor chain. */
+    uint32_t len;               /* Bytes written by the device. */
+  };
+
+/* Ring of descriptor chains that the device has finished with. */
+struct vring_used
+  {
+    uint16_t flags;             /* Ignored. */
+    uint16_t idx;               /* Where device puts next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Header at the start of each virtio block request. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;          /* Always 0. */
+    uint64_t sector;            /* First 512-byte sector. */
+  };
+
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_S_OK 0       /* Status of a successful request. */
+
+/* Largest number of data buffers in one virtio request.  A
+   request chain from the I/O scheduler with more requests than
+   this is passed to the device a part at a time. */
+#define SEG_MAX 14
+
+/* Number of descriptors used by each slot: a header, SEG_MAX data
+   buffers and a status byte. */
+#define SLOT_DESCS (SEG_MAX + 2)
+
+/* Largest number of request chains in progress on a disk at
+   once.  Fewer if the virtqueue is too small. */
+#define SLOT_MAX 16
+
+/* A request chain in progress on a disk.  Slot I always uses
+   descriptors I * SLOT_DESCS through I * SLOT_DESCS + SLOT_DESCS
+   - 1, so we never have to allocate them. */
+struct slot
+  {
+    struct block_request *chain;    /* First request, null if free. */
+    struct block_request *cursor;   /* First request in device. */
+    struct block_request *stop;     /* Request after the last one in
+                                       the device, null at the end. */
+    struct virtio_blk_header header;    /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+  };
+
+/* A virtio disk. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt in use. */
+    struct block *block;        /* Block device, once registered. */
+
+    /* The virtqueue, in pages of its own. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t used_idx;          /* Next used ring entry to look at. */
+
+    /* Request chains in progress.  Only touched with interrupts
+       off. */
+    struct slot slots[SLOT_MAX];
+    int slot_cnt;               /* Number of slots in use. */
+  };
+
+/* We support up to four disks, which is as many as the pintos
+   utility can attach. */
+#define DISK_MAX 4
+static struct virtio_disk disks[DISK_MAX];
+static int disk_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static bool init_disk (struct virtio_disk *, const struct pci_dev *);
+static void register_disk (struct virtio_disk *);
+static bool setup_queue (struct virtio_disk *);
+static void fill_slots (struct virtio_disk *);
+static void start_part (struct virtio_disk *, struct slot *);
+static void finish_part (struct virtio_disk *, struct slot *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds virtio disks on the PCI bus and registers them with the
+   block device layer. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev dev;
+  int i;
+
+  for (i = 0; disk_cnt < DISK_MAX
+         && pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, i, &dev);
+       i++)
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + disk_cnt);
+      if (init_disk (d, &dev))
+        {
+          /* The interrupt handler only looks at the disks before
+             disk_cnt, and D interrupts as soon as it is used. */
+          disk_cnt++;
+          register_disk (d);
+        }
+    }
+}
+
+/* Sets up disk D, found at PCI function DEV, so that it is ready
+   to take requests.  Returns true if successful, false if D
+   can't be used. */
+static bool
+init_disk (struct virtio_disk *d, const struct pci_dev *dev)
+{
+  uint8_t irq_line = pci_read_config (dev, PCI_REG_IRQ) & 0xff;
+  int i;
+
+  d->io_base = pci_io_bar (dev, 0);
+  d->irq = irq_line + 0x20;
+  d->block = NULL;
+  d->used_idx = 0;
+  if (d->io_base == 0 || irq_line >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt line, ignoring\n", d->name);
+      return false;
+    }
+  pci_enable_bus_master (dev);
+
+  /* Reset the device and tell it that we know what it is.  We
+     don't need any optional features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (reg_guest_features (d), 0);
+
+  if (!setup_queue (d))
+    {
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+
+  /* Several disks may share an interrupt line.  Any other handler
+     for the line would be a conflict that we can't handle. */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      break;
+  if (i == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return true;
+}
+
+/* Registers disk D, which is ready to take requests, with the
+   block device layer. */
+static void
+register_disk (struct virtio_disk *d)
+{
+  uint32_t capacity_lo, capacity_hi;
+  char extra_info[64];
+
+  /* Block devices are limited to 2 TB. */
+  capacity_lo = inl (reg_capacity (d));
+  capacity_hi = inl (reg_capacity (d) + 4);
+  if (capacity_hi != 0)
+    capacity_lo = UINT32_MAX;
+
+  /* Register. */
+  snprintf (extra_info, sizeof extra_info, "virtio, %d requests at once",
+            d->slot_cnt);
+  d->block = block_register (d->name, BLOCK_RAW, extra_info, capacity_lo,
+                             &virtio_blk_operations, d);
+  partition_scan (d->block);
+}
+
+/* Allocates memory for disk D's virtqueue, in the layout that
+   the legacy interface requires, and tells D where it is.
+   Returns true if successful, false on failure. */
+static bool
+setup_queue (struct virtio_disk *d)
+{
+  size_t avail_end, used_ofs, size;
+  uint8_t *queue;
+
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  d->slot_cnt = d->queue_size / SLOT_DESCS;
+  if (d->slot_cnt > SLOT_MAX)
+    d->slot_cnt = SLOT_MAX;
+  if (d->slot_cnt == 0)
+    {
+      printf ("%s: virtqueue of %"PRIu16" entries is too small\n",
+              d->name, d->queue_size);
+      return false;
+    }
+
+  avail_end = (sizeof *d->desc * d->queue_size
+               + sizeof *d->avail + sizeof *d->avail->ring * d->queue_size
+               + sizeof (uint16_t));
+  used_ofs = ROUND_UP (avail_end, QUEUE_ALIGN);
+  size = (used_ofs + sizeof *d->used + sizeof *d->used->ring * d->queue_size
+          + sizeof (uint16_t));
+
+  /* Kernel pages are physically contiguous, as the device needs. */
+  queue = palloc_get_multiple (PAL_ZERO, DIV_ROUND_UP (size, PGSIZE));
+  if (queue == NULL)
+    {
+      printf ("%s: out of memory for virtqueue\n", d->name);
+      return false;
+    }
+  d->desc = (struct vring_desc *) queue;
+  d->avail = (struct vring_avail *) (queue
+                                     + sizeof *d->desc * d->queue_size);
+  d->used = (struct vring_used *) (queue + used_ofs);
+
+  outl (reg_queue_pfn (d), vtop (queue) / QUEUE_ALIGN);
+  return true;
+}
+
+/* Tells disk D that requests are waiting in its I/O scheduler.
+   Disk D works on as many request chains at once as it has
+   slots, calling each request's completion function from its
+   interrupt handler when it is done, so nobody has to wait for
+   the disk unless they want to. */
+static void
+virtio_blk_start (void *d)
+{
+  fill_slots (d);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    virtio_blk_start
+  };
+
+/* Takes a request chain from disk D's I/O scheduler for each of
+   D's free slots, for as long as there are any, and passes them
+   to the device.  Interrupts must be off. */
+static void
+fill_slots (struct virtio_disk *d)
+{
+  bool started = false;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < d->slot_cnt; i++)
+    {
+      struct slot *s = &d->slots[i];
+      struct block_request *r;
+
+      if (s->chain != NULL)
+        continue;
+      r = block_next_request (d->block);
+      if (r == NULL)
+        break;
+
+      s->chain = s->cursor = r;
+      start_part (d, s);
+      started = true;
+    }
+
+  if (started)
+    outw (reg_queue_notify (d), 0);
+}
+
+/* Describes as much of slot S's request chain, from the cursor
+   on, as fits in S's descriptors, and makes it available to disk
+   D.  The caller must notify D. */
+static void
+start_part (struct virtio_disk *d, struct slot *s)
+{
+  uint16_t head = (s - d->slots) * SLOT_DESCS;
+  struct vring_desc *desc = &d->desc[head];
+  struct block_request *r = s->cursor;
+  bool write = r->write;
+  int i;
+
+  s->header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->header.reserved = 0;
+  s->header.sector = r->sector;
+  s->status = 0xff;
+
+  desc[0].addr = vtop (&s->header);
+  desc[0].len = sizeof s->header;
+  desc[0].flags = 0;
+  for (i = 1; r != NULL && i <= SEG_MAX; r = r->merge_next, i++)
+    {
+      /* All of our buffers are in kernel memory, whose physical
+         addresses are contiguous. */
+      ASSERT (is_kernel_vaddr (r->buffer));
+      desc[i].addr = vtop (r->buffer);
+      desc[i].len = r->cnt * BLOCK_SECTOR_SIZE;
+      desc[i].flags = write ? 0 : VRING_DESC_F_WRITE;
+    }
+  s->stop = r;
+  desc[i].addr = vtop (&s->status);
+  desc[i].len = sizeof s->status;
+  desc[i].flags = VRING_DESC_F_WRITE;
+
+  for (; i > 0; i--)
+    {
+      desc[i - 1].flags |= VRING_DESC_F_NEXT;
+      desc[i - 1].next = head + i;
+    }
+
+  /* The device must not see the new entry before the
+     descriptors, nor the new index before the entry. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+}
+
+/* Carries on with slot S on disk D now that the device has
+   finished with the part of S's request chain it was given.
+   Once the chain is done, starts on another and calls the
+   completion function of each request in the chain. */
+static void
+finish_part (struct virtio_disk *d, struct slot *s)
+{
+  struct block_request *r;
+  struct block_request *done;
+
+  if (s->status != VIRTIO_BLK_S_OK)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+           s->cursor->write ? "write" : "read", s->cursor->sector);
+  for (r = s->cursor; r != s->stop; r = r->merge_next)
+    r->done_cnt = r->cnt;
+
+  if (s->stop != NULL)
+    {
+      s->cursor = s->stop;
+      start_part (d, s);
+      outw (reg_queue_notify (d), 0);
+      return;
+    }
+
+  /* Start another chain before completing this one, in case a
+     completion function submits another request. */
+  done = s->chain;
+  s->chain = NULL;
+  fill_slots (d);
+  block_complete (done);
+}
+
+/* virtio-blk interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  struct virtio_disk *d;
+
+  for (d = disks; d < disks + disk_cnt; d++)
+    if (f->vec_no == d->irq
+        && (inb (reg_isr (d)) & ISR_QUEUE) != 0)  /* Acknowledge. */
+      for (;;)
+        {
+          struct vring_used_elem *e;
+
+          barrier ();
+          if (d->used_idx == d->used->idx)
+            break;
+          barrier ();
+          e = &d->used->ring[d->used_idx % d->queue_size];
+          d->used_idx++;
+          finish_part (d, &d->slots[e->id / SLOT_DESCS]);
+        }
+}
@@ -0,0 +1,483 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   Every access to a sector of the file system device goes
+   through a fixed-size cache of sectors.  Writes only change the
+   cached copy; dirty sectors reach the disk when they are
+   evicted, when the flusher thread next runs, or when
+   cache_flush() is called.  Sequential reads queue the
+   following sector for a read-ahead thread to bring in; it
+   submits all the sectors queued at the time to the disk at
+   once, without waiting for each in turn. */
+
+/* Number of sectors held in the cache. */
+#define CACHE_SIZE 64
+
+/* Timer ticks between write-behind passes of the flusher. */
+#define FLUSH_PERIOD TIMER_FREQ
+
+/* Maximum number of queued read-ahead requests. */
+#define READ_AHEAD_MAX 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if VALID. */
+    bool valid;                         /* Holds a sector? */
+    bool dirty;                         /* Changed since last written? */
+    bool accessed;                      /* Used since clock last passed? */
+    bool busy;                          /* Being read from or written to
+                                           disk by the cache, or filled
+                                           by a writer. */
+    int user_cnt;                       /* Callers copying to or from
+                                           DATA. */
+    uint8_t *data;                      /* Sector data. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the cache entries.  An entry's data may be read or
+   written without the lock by the cache while the entry is busy,
+   or by callers while it has users.  Busy entries have no users
+   other than a writer filling a newly assigned entry, and entries
+   with users are not evicted or written back. */
+static struct lock cache_lock;
+
+/* Signalled when an entry stops being busy or loses its last
+   user. */
+static struct condition cache_changed;
+
+/* Next entry for the clock hand to consider for eviction. */
+static size_t clock_hand;
+
+/* Circular queue of sectors waiting to be read ahead.
+   Protected by cache_lock. */
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head;          /* Oldest request. */
+static size_t read_ahead_queued;        /* Number of requests. */
+static struct condition read_ahead_ready;
+
+/* Statistics. */
+static long long hit_cnt;               /* Accesses to cached sectors. */
+static long long miss_cnt;              /* Accesses that had to load. */
+static long long read_ahead_cnt;        /* Sectors read ahead. */
+static long long write_back_cnt;        /* Dirty sectors written. */
+
+static struct cache_entry *cache_get (block_sector_t, bool read, bool *hit);
+static void cache_put (struct cache_entry *, bool dirty);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_choose_victim (void);
+static struct cache_entry *cache_claim (block_sector_t);
+static void cache_write_back (struct cache_entry *);
+static void flusher (void *aux);
+static void read_ahead_daemon (void *aux);
+
+/* Initializes the buffer cache and starts its threads. */
+void
+cache_init (void)
+{
+  size_t page_cnt = CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE;
+  uint8_t *buffers = palloc_get_multiple (PAL_ASSERT, page_cnt);
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&cache_changed);
+  cond_init (&read_ahead_ready);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].valid = false;
+      cache[i].busy = false;
+      cache[i].user_cnt = 0;
+      cache[i].data = buffers + i * BLOCK_SECTOR_SIZE;
+    }
+
+  thread_create ("cache-flush", PRI_DEFAULT, flusher, NULL);
+  thread_create ("cache-readahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS of sector SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+  bool hit;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = cache_get (sector, true, &hit);
+  if (hit)
+    hit_cnt++;
+  else
+    miss_cnt++;
+  lock_release (&cache_lock);
+
+  /* BUFFER may be in user memory, so we can't hold the lock while
+     copying into it in case we page fault. */
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e, false);
+}
+
+/* Writes sector SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to sector SECTOR, starting at
+   byte OFS. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, size_t ofs,
+                size_t size)
+{
+  struct cache_entry *e;
+  bool hit;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* There's no need to read the sector in if we are going to
+     overwrite all of it. */
+  lock_acquire (&cache_lock);
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, &hit);
+  if (hit)
+    hit_cnt++;
+  else
+    miss_cnt++;
+  lock_release (&cache_lock);
+
+  memcpy (e->data + ofs, buffer, size);
+  cache_put (e, true);
+}
+
+/* Asks for SECTOR to be brought into the cache in the
+   background, because it is likely to be read soon. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (read_ahead_queued < READ_AHEAD_MAX && cache_lookup (sector) == NULL)
+    {
+      size_t tail = (read_ahead_head + read_ahead_queued) % READ_AHEAD_MAX;
+      read_ahead_queue[tail] = sector;
+      read_ahead_queued++;
+      cond_signal (&read_ahead_ready, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector in the cache to disk.  Sectors that
+   are being written to at the time are skipped.
+
+   The changed parts of the free map are written into the cache
+   first, so that the sectors allocated to the inodes and data
+   written out are not left marked free on disk.  If that fails,
+   the free map keeps track of what is still unwritten and the
+   next flush tries again. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  free_map_sync ();
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      /* Let any write already under way finish, so that
+         everything is on disk when we return. */
+      while (e->busy)
+        cond_wait (&cache_changed, &cache_lock);
+      if (e->valid && e->dirty && e->user_cnt == 0)
+        cache_write_back (e);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld read ahead, "
+          "%lld written back\n",
+          hit_cnt, miss_cnt, read_ahead_cnt, write_back_cnt);
+}
+
+/* Returns the cache entry for SECTOR, with one more user, first
+   bringing SECTOR into the cache if it isn't there.  It is read
+   from disk only if READ is true; otherwise its contents are
+   undefined, and the new entry stays busy, keeping other callers
+   away from the stale data, until the caller has filled it and
+   calls cache_put().  Sets *HIT to whether SECTOR was already
+   cached.
+   Must be called with cache_lock held, which is released while
+   waiting for I/O. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read, bool *hit)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      struct cache_entry *e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          if (e->busy)
+            {
+              /* Wait for the read or write to finish, then look
+                 again. */
+              cond_wait (&cache_changed, &cache_lock);
+              continue;
+            }
+          e->accessed = true;
+          e->user_cnt++;
+          *hit = true;
+          return e;
+        }
+
+      e = cache_choose_victim ();
+      if (e == NULL)
+        {
+          cond_wait (&cache_changed, &cache_lock);
+          continue;
+        }
+      if (e->valid && e->dirty)
+        {
+          /* Things may have changed by the time the victim has
+             been written, so start again. */
+          cache_write_back (e);
+          continue;
+        }
+
+      e->sector = sector;
+      e->valid = true;
+      e->dirty = false;
+      e->accessed = true;
+      if (read)
+        {
+          e->busy = true;
+          lock_release (&cache_lock);
+          block_read (fs_device, sector, e->data);
+          lock_acquire (&cache_lock);
+          e->busy = false;
+          cond_broadcast (&cache_changed, &cache_lock);
+        }
+      else
+        e->busy = true;
+      e->user_cnt++;
+      *hit = false;
+      return e;
+    }
+}
+
+/* Gives up a use of E obtained from cache_get(), marking it dirty
+   if DIRTY is true.  If E was busy because the caller was filling
+   it, it is now ready for others. */
+static void
+cache_put (struct cache_entry *e, bool dirty)
+{
+  lock_acquire (&cache_lock);
+  ASSERT (e->user_cnt > 0);
+  if (dirty)
+    e->dirty = true;
+  if (--e->user_cnt == 0 || e->busy)
+    {
+      e->busy = false;
+      cond_broadcast (&cache_changed, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if it is not
+   cached.  Must be called with cache_lock held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an entry to reuse with the clock algorithm, or returns
+   a null pointer if every entry is in use.  Must be called with
+   cache_lock held. */
+static struct cache_entry *
+cache_choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->busy || e->user_cnt > 0)
+        continue;
+      if (!e->valid)
+        return e;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+      return e;
+    }
+  return NULL;
+}
+
+/* Returns a clean entry, not in use, that has been reassigned to
+   SECTOR and marked busy, so that the caller may read SECTOR
+   into it without cache_lock held.  Returns a null pointer if
+   SECTOR is already cached or every entry is in use.  Must be
+   called with cache_lock held, which may be released while
+   writing back a dirty victim. */
+static struct cache_entry *
+cache_claim (block_sector_t sector)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+
+      if (cache_lookup (sector) != NULL)
+        return NULL;
+      e = cache_choose_victim ();
+      if (e == NULL)
+        return NULL;
+      if (e->valid && e->dirty)
+        {
+          cache_write_back (e);
+          continue;
+        }
+
+      e->sector = sector;
+      e->valid = true;
+      e->dirty = false;
+      e->accessed = true;
+      e->busy = true;
+      return e;
+    }
+}
+
+/* Writes dirty entry E to disk.  Must be called with cache_lock
+   held, which is released during the write. */
+static void
+cache_write_back (struct cache_entry *e)
+{
+  ASSERT (e->valid && e->dirty && !e->busy && e->user_cnt == 0);
+
+  e->busy = true;
+  lock_release (&cache_lock);
+  block_write (fs_device, e->sector, e->data);
+  lock_acquire (&cache_lock);
+  e->busy = false;
+  e->dirty = false;
+  write_back_cnt++;
+  cond_broadcast (&cache_changed, &cache_lock);
+}
+
+/* Flusher thread: writes dirty sectors back every FLUSH_PERIOD
+   ticks, so that they don't all have to be written when they
+   are evicted or at shutdown. */
+static void
+flusher (void *aux UNUSED)
+{
+  block_set_class (BLOCK_CLASS_BACKGROUND);
+  for (;;)
+    {
+      timer_sleep (FLUSH_PERIOD);
+      cache_flush ();
+    }
+}
+
+/* Completion function for read-ahead requests. */
+static void
+read_ahead_done (struct block_request *request)
+{
+  sema_up (request->aux);
+}
+
+/* Read-ahead thread: brings queued sectors into the cache.  All
+   the sectors queued at a time are submitted to the disk
+   together, so that it can work on them back to back. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      /* Static because they are too big for a thread's stack.
+         There is only one read-ahead thread. */
+      static struct block_request requests[READ_AHEAD_MAX];
+      static struct cache_entry *entries[READ_AHEAD_MAX];
+      struct semaphore done;
+      size_t cnt = 0;
+      size_t i;
+
+      while (read_ahead_queued == 0)
+        cond_wait (&read_ahead_ready, &cache_lock);
+
+      /* Claim an entry for each queued sector not already
+         cached. */
+      while (read_ahead_queued > 0)
+        {
+          block_sector_t sector = read_ahead_queue[read_ahead_head];
+          struct cache_entry *e;
+
+          read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+          read_ahead_queued--;
+          e = cache_claim (sector);
+          if (e != NULL)
+            entries[cnt++] = e;
+        }
+      if (cnt == 0)
+        continue;
+      lock_release (&cache_lock);
+
+      sema_init (&done, 0);
+      for (i = 0; i < cnt; i++)
+        {
+          struct block_request *r = &requests[i];
+          r->write = false;
+          r->class = BLOCK_CLASS_BACKGROUND;
+          r->sector = entries[i]->sector;
+          r->cnt = 1;
+          r->buffer = entries[i]->data;
+          r->complete = read_ahead_done;
+          r->aux = &done;
+          block_submit (fs_device, r);
+        }
+      for (i = 0; i < cnt; i++)
+        sema_down (&done);
+
+      lock_acquire (&cache_lock);
+      for (i = 0; i < cnt; i++)
+        entries[i]->busy = false;
+      read_ahead_cnt += cnt;
+      cond_broadcast (&cache_changed, &cache_lock);
+    }
+}
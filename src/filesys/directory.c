@@ -1,6 +1,7 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -10,7 +11,8 @@
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current position, as an
+                                           entry slot number. */
   };
 
 /* A single directory entry. */
@@ -21,12 +23,132 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* On-disk directory layout.
+
+   A directory is a hash table of entries keyed on file name.
+   The first sector of the directory's inode holds a struct
+   dir_header, and each following sector holds one struct
+   dir_bucket.  A name lives in the bucket its hash selects, or
+   if that is full, in the first bucket after it with a free
+   slot.  Buckets that have been passed over this way are marked
+   as overflowed, so that a search can stop at the first bucket
+   that is not, and both a search and a free-slot scan normally
+   touch only the header and a single bucket.
+
+   The number of buckets is always a power of 2, and is doubled
+   when the table becomes more than 3/4 full.
+
+   Operations on a directory hold its inode's user lock (see
+   inode_lock()), so that each sees and leaves the table in a
+   consistent state. */
+
+/* Identifies a directory. */
+#define DIR_MAGIC 0x44495248
+
+/* Number of entries in a bucket. */
+#define BUCKET_ENTRIES \
+        ((BLOCK_SECTOR_SIZE - 2 * sizeof (uint32_t)) \
+         / sizeof (struct dir_entry))
+
+/* Directory header, in the first sector of a directory. */
+struct dir_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t bucket_cnt;                /* Number of buckets. */
+    uint32_t entry_cnt;                 /* Number of entries in use. */
+  };
+
+/* A hash bucket, one sector long. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES];
+    uint32_t in_use_cnt;                /* Entries in use.  Free-slot hint:
+                                           full buckets are skipped without
+                                           looking at their entries. */
+    uint32_t overflowed;                /* Nonzero if a name that hashes
+                                           here may be in a later bucket. */
+  };
+
+/* Returns the byte offset of bucket IDX within a directory. */
+static inline off_t
+bucket_ofs (size_t idx) 
+{
+  return (idx + 1) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the number of buckets needed to hold ENTRY_CNT entries
+   without the table getting more than 3/4 full. */
+static size_t
+buckets_for (size_t entry_cnt) 
+{
+  size_t bucket_cnt = 1;
+  while (bucket_cnt * BUCKET_ENTRIES * 3 < entry_cnt * 4)
+    bucket_cnt *= 2;
+  return bucket_cnt;
+}
+
+/* Reads DIR's header into *H.  Returns true if successful. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h) 
+{
+  return (inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+          && h->magic == DIR_MAGIC);
+}
+
+/* Writes *H as DIR's header.  Returns true if successful. */
+static bool
+write_header (struct dir *dir, const struct dir_header *h) 
+{
+  return inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Reads bucket IDX of DIR into *B.  Returns true if successful. */
+static bool
+read_bucket (const struct dir *dir, size_t idx, struct dir_bucket *b) 
+{
+  return inode_read_at (dir->inode, b, sizeof *b, bucket_ofs (idx))
+         == sizeof *b;
+}
+
+/* Writes *B as bucket IDX of DIR.  Returns true if successful. */
+static bool
+write_bucket (struct dir *dir, size_t idx, const struct dir_bucket *b) 
+{
+  return inode_write_at (dir->inode, b, sizeof *b, bucket_ofs (idx))
+         == sizeof *b;
+}
+
+/* Returns the bucket that NAME hashes to in a table of BUCKET_CNT
+   buckets. */
+static size_t
+home_bucket (const char *name, size_t bucket_cnt) 
+{
+  return hash_string (name) & (bucket_cnt - 1);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct dir *dir;
+  bool success;
+
+  h.magic = DIR_MAGIC;
+  h.bucket_cnt = buckets_for (entry_cnt);
+  h.entry_cnt = 0;
+
+  /* A zeroed sector is an empty bucket, so only the header needs
+     to be written. */
+  if (!inode_create (sector, bucket_ofs (h.bucket_cnt)))
+    return false;
+  dir = dir_open (inode_open (sector));
+  if (dir == NULL)
+    return false;
+  success = write_header (dir, &h);
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,34 +205,138 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches DIR, whose header is H, for a file with the given
+   NAME, using B as scratch space.
    If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   if EP is non-null, and sets *BUCKETP and *SLOTP to its bucket
+   and slot within the bucket if they are non-null.
+   Otherwise, returns false and ignores EP, BUCKETP and SLOTP. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+lookup (const struct dir *dir, const struct dir_header *h,
+        struct dir_bucket *b, const char *name,
+        struct dir_entry *ep, size_t *bucketp, size_t *slotp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  size_t idx = home_bucket (name, h->bucket_cnt);
+  size_t i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  for (i = 0; i < h->bucket_cnt; i++, idx = (idx + 1) & (h->bucket_cnt - 1))
+    {
+      size_t slot;
+
+      if (!read_bucket (dir, idx, b))
+        return false;
+      for (slot = 0; slot < BUCKET_ENTRIES; slot++) 
+        {
+          struct dir_entry *e = &b->entries[slot];
+          if (e->in_use && !strcmp (name, e->name)) 
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (bucketp != NULL)
+                *bucketp = idx;
+              if (slotp != NULL)
+                *slotp = slot;
+              return true;
+            }
+        }
+      if (!b->overflowed)
+        break;
+    }
   return false;
 }
 
+/* Stores an entry for NAME with INODE_SECTOR into the first free
+   slot of DIR, whose header is H, starting from NAME's home
+   bucket, using B as scratch space.  Marks buckets skipped over
+   as overflowed.  The caller must make sure that there is a free
+   slot, and update the entry count in H.
+   Returns true if successful, false on failure. */
+static bool
+insert (struct dir *dir, const struct dir_header *h, struct dir_bucket *b,
+        const char *name, block_sector_t inode_sector) 
+{
+  size_t idx = home_bucket (name, h->bucket_cnt);
+  size_t slot;
+
+  for (;;)
+    {
+      if (!read_bucket (dir, idx, b))
+        return false;
+      if (b->in_use_cnt < BUCKET_ENTRIES)
+        break;
+      if (!b->overflowed)
+        {
+          b->overflowed = true;
+          if (!write_bucket (dir, idx, b))
+            return false;
+        }
+      idx = (idx + 1) & (h->bucket_cnt - 1);
+    }
+
+  slot = 0;
+  while (b->entries[slot].in_use)
+    {
+      slot++;
+      ASSERT (slot < BUCKET_ENTRIES);
+    }
+
+  b->entries[slot].in_use = true;
+  strlcpy (b->entries[slot].name, name, sizeof b->entries[slot].name);
+  b->entries[slot].inode_sector = inode_sector;
+  b->in_use_cnt++;
+  return write_bucket (dir, idx, b);
+}
+
+/* Doubles the number of buckets in DIR, whose header is H, and
+   rehashes its entries into them, using B as scratch space.
+   Returns true if successful, false on failure, in which case
+   the directory is unchanged if memory ran out, or may be
+   damaged on a disk error. */
+static bool
+grow (struct dir *dir, struct dir_header *h, struct dir_bucket *b) 
+{
+  struct dir_entry *entries;
+  size_t entry_cnt = 0;
+  size_t old_cnt = h->bucket_cnt;
+  size_t i;
+  bool success = false;
+
+  /* Save the entries in use. */
+  entries = malloc (h->entry_cnt * sizeof *entries);
+  if (entries == NULL && h->entry_cnt > 0)
+    return false;
+  for (i = 0; i < old_cnt; i++)
+    {
+      size_t slot;
+
+      if (!read_bucket (dir, i, b))
+        goto done;
+      for (slot = 0; slot < BUCKET_ENTRIES; slot++)
+        if (b->entries[slot].in_use && entry_cnt < h->entry_cnt)
+          entries[entry_cnt++] = b->entries[slot];
+    }
+
+  /* Empty every bucket of the new table, then put the entries
+     back. */
+  memset (b, 0, sizeof *b);
+  h->bucket_cnt = old_cnt * 2;
+  for (i = 0; i < h->bucket_cnt; i++)
+    if (!write_bucket (dir, i, b))
+      goto done;
+  for (i = 0; i < entry_cnt; i++)
+    if (!insert (dir, h, b, entries[i].name, entries[i].inode_sector))
+      goto done;
+  h->entry_cnt = entry_cnt;
+  success = write_header (dir, h);
+
+ done:
+  free (entries);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -119,15 +345,25 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  struct dir_header h;
+  struct dir_bucket *b;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  *inode = NULL;
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  /* The inode is opened before the lock is released, so that it
+     can't be removed and freed in between. */
+  inode_lock (dir->inode);
+  if (read_header (dir, &h) && lookup (dir, &h, b, name, &e, NULL, NULL))
     *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  inode_unlock (dir->inode);
+  free (b);
 
   return *inode != NULL;
 }
@@ -141,8 +377,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_header h;
+  struct dir_bucket *b;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +388,33 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  inode_lock (dir->inode);
+  if (!read_header (dir, &h))
+    goto done;
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (lookup (dir, &h, b, name, NULL, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Keep the table at most 3/4 full.  If it can't grow, carry on
+     as long as there is still a free slot. */
+  if ((h.entry_cnt + 1) * 4 > h.bucket_cnt * BUCKET_ENTRIES * 3
+      && !grow (dir, &h, b)
+      && h.entry_cnt >= h.bucket_cnt * BUCKET_ENTRIES)
+    goto done;
 
   /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (!insert (dir, &h, b, name, inode_sector))
+    goto done;
+  h.entry_cnt++;
+  success = write_header (dir, &h);
 
  done:
+  inode_unlock (dir->inode);
+  free (b);
   return success;
 }
 
@@ -184,16 +424,24 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_header h;
+  struct dir_bucket *b;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
+  size_t idx, slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!read_header (dir, &h)
+      || !lookup (dir, &h, b, name, &e, &idx, &slot))
     goto done;
 
   /* Open inode. */
@@ -201,9 +449,13 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  /* Erase directory entry.  The bucket stays marked as overflowed
+     if it was, since other names may still have spilled past
+     it. */
+  b->entries[slot].in_use = false;
+  b->in_use_cnt--;
+  h.entry_cnt--;
+  if (!write_bucket (dir, idx, b) || !write_header (dir, &h))
     goto done;
 
   /* Remove inode. */
@@ -211,7 +463,9 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  inode_unlock (dir->inode);
   inode_close (inode);
+  free (b);
   return success;
 }
 
@@ -221,16 +475,31 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_header h;
   struct dir_entry e;
+  bool success = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  inode_lock (dir->inode);
+  if (!read_header (dir, &h))
+    goto done;
+  while ((size_t) dir->pos < h.bucket_cnt * BUCKET_ENTRIES) 
     {
-      dir->pos += sizeof e;
+      size_t idx = dir->pos / BUCKET_ENTRIES;
+      size_t slot = dir->pos % BUCKET_ENTRIES;
+
+      if (inode_read_at (dir->inode, &e, sizeof e,
+                         bucket_ofs (idx) + slot * sizeof e) != sizeof e)
+        goto done;
+      dir->pos++;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+
+ done:
+  inode_unlock (dir->inode);
+  return success;
 }
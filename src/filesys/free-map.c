@@ -1,70 +1,301 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file whose contents on disk are out of
+   date, one bit per sector of the file.  The in-memory free map
+   is always authoritative; changed sectors of the file are only
+   written by free_map_sync(), which every cache flush calls, so
+   they reach the disk at least as often as the flusher runs. */
+static struct bitmap *dirty_map;
+
+/* Protects everything in this file, including free_map_file
+   once the file system is running, since the cache flusher may
+   sync the free map while it is being opened or closed. */
+static struct lock free_map_lock;
+
+/* Bits of the free map held by each sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Free extent index.
+
+   Alongside the bitmap, which is what goes to disk, every
+   maximal run of free sectors is kept as a struct extent.
+   Extents can be found by their first sector and by the sector
+   just past their end, through two hash tables, and by locality
+   group and size, through lists.  The disk is divided into
+   groups of GROUP_SECTORS sectors, and each group has a list per
+   size class for the extents that start in it.  Size class K
+   holds extents at least 2**K sectors long and, except for the
+   last class, shorter than 2**(K+1).
+
+   An allocation first tries to start right at its goal sector,
+   then takes the first extent that fits from the smallest
+   suitable size class of the goal's group, then of groups
+   further and further away.
+
+   The index is built from the bitmap whenever the bitmap is
+   read.  If memory for an extent runs out, the index is marked
+   stale and allocation falls back to scanning the bitmap until
+   the index can be rebuilt. */
+#define GROUP_SECTORS 512
+#define SIZE_CLASS_CNT 10
+
+/* A run of free sectors. */
+struct extent
+  {
+    struct hash_elem start_elem;        /* Element in extents_by_start. */
+    struct hash_elem end_elem;          /* Element in extents_by_end. */
+    struct list_elem list_elem;         /* Element in a class list. */
+    block_sector_t start;               /* First sector. */
+    size_t length;                      /* Number of sectors. */
+  };
+
+static struct hash extents_by_start;
+static struct hash extents_by_end;
+static struct list *class_lists;        /* group_cnt * SIZE_CLASS_CNT. */
+static size_t group_cnt;                /* Number of locality groups. */
+static bool index_stale;                /* Must the index be rebuilt? */
+
+/* Statistics. */
+static long long alloc_cnt;             /* Successful allocations. */
+static long long goal_cnt;              /* ...that started at the goal. */
+static long long group_hit_cnt;         /* ...within the goal's group. */
+
+static bool sync_dirty (void);
+static void mark_dirty (block_sector_t, size_t);
+static void index_rebuild (void);
+static block_sector_t index_allocate (block_sector_t goal, size_t cnt);
+static void index_release (block_sector_t, size_t);
+static hash_hash_func extent_start_hash;
+static hash_hash_func extent_end_hash;
+static hash_less_func extent_start_less;
+static hash_less_func extent_end_less;
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  size_t i;
+
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                           BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  class_lists = malloc (group_cnt * SIZE_CLASS_CNT * sizeof *class_lists);
+  if (class_lists == NULL
+      || !hash_init (&extents_by_start, extent_start_hash,
+                     extent_start_less, NULL)
+      || !hash_init (&extents_by_end, extent_end_hash, extent_end_less, NULL))
+    PANIC ("free extent index creation failed");
+  for (i = 0; i < group_cnt * SIZE_CLASS_CNT; i++)
+    list_init (&class_lists[i]);
+  index_rebuild ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the free map file
+   at the next free_map_sync(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but tries to allocate the sectors
+   starting at GOAL, or failing that, as close to GOAL as it
+   can, so that sectors allocated one at a time for the same file
+   tend to end up next to each other. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (index_stale)
+    index_rebuild ();
+  if (!index_stale)
+    sector = index_allocate (goal, cnt);
+  else
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      sector = bitmap_scan_and_flip_next (free_map, cnt, false);
+      if (sector != BITMAP_ERROR)
+        mark_dirty (sector, cnt);
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+    alloc_cnt++;
+  lock_release (&free_map_lock);
+
+  if (sector == BITMAP_ERROR)
+    return false;
+  *sectorp = sector;
+  return true;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  if (!index_stale)
+    index_release (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Prints statistics on how fragmented free space is. */
+void
+free_map_print_stats (void)
+{
+  size_t class_extents[SIZE_CLASS_CNT];
+  size_t extent_cnt = 0, free_cnt = 0, largest = 0;
+  struct hash_iterator i;
+  size_t k;
+
+  for (k = 0; k < SIZE_CLASS_CNT; k++)
+    class_extents[k] = 0;
+
+  lock_acquire (&free_map_lock);
+  if (index_stale)
+    index_rebuild ();
+  hash_first (&i, &extents_by_start);
+  while (hash_next (&i))
+    {
+      struct extent *e = hash_entry (hash_cur (&i), struct extent,
+                                     start_elem);
+      extent_cnt++;
+      free_cnt += e->length;
+      if (e->length > largest)
+        largest = e->length;
+    }
+  for (k = 0; k < group_cnt * SIZE_CLASS_CNT; k++)
+    class_extents[k % SIZE_CLASS_CNT] += list_size (&class_lists[k]);
+  lock_release (&free_map_lock);
+
+  printf ("Free map: %zu free sectors in %zu extents, largest %zu\n",
+          free_cnt, extent_cnt, largest);
+  for (k = 0; k < SIZE_CLASS_CNT; k++)
+    if (class_extents[k] > 0)
+      printf ("  %5zu%s sectors: %zu extents\n", (size_t) 1 << k,
+              k + 1 < SIZE_CLASS_CNT ? " " : "+", class_extents[k]);
+  printf ("Free map: %lld allocations, %lld at goal, "
+          "%lld in goal's group\n", alloc_cnt, goal_cnt, group_hit_cnt);
+}
+
+/* Writes the sectors of the free map file that have changed
+   since they were last written.  Returns true if successful,
+   false if a sector could not be written. */
+bool
+free_map_sync (void)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = sync_dirty ();
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Does the work of free_map_sync().  free_map_lock must be
+   held. */
+static bool
+sync_dirty (void)
+{
+  size_t start = 0;
+  bool success = true;
+
+  if (free_map_file == NULL)
+    return true;
+
+  /* Write each run of dirty sectors with a single call.  Writing
+     the free map file never allocates sectors, so holding the
+     lock across the writes can't deadlock. */
+  while ((start = bitmap_scan (dirty_map, start, 1, true)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (dirty_map, start, 1, false);
+      size_t first_bit, bit_cnt;
+
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (dirty_map);
+      first_bit = start * BITS_PER_SECTOR;
+      bit_cnt = (end - start) * BITS_PER_SECTOR;
+      if (bit_cnt > bitmap_size (free_map) - first_bit)
+        bit_cnt = bitmap_size (free_map) - first_bit;
+
+      if (bitmap_write_range (free_map, free_map_file, first_bit, bit_cnt))
+        bitmap_set_multiple (dirty_map, start, end - start, false);
+      else
+        success = false;
+      start = end;
+    }
+  return success;
+}
+
+/* Records that the free map bits for the CNT sectors starting at
+   SECTOR have changed.  free_map_lock must be held. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first, last;
+
+  if (cnt == 0)
+    return;
+  first = sector / BITS_PER_SECTOR;
+  last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void) 
 {
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  lock_acquire (&free_map_lock);
+  if (!bitmap_read (free_map, file))
     PANIC ("can't read free map");
+  free_map_file = file;
+  index_rebuild ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  lock_acquire (&free_map_lock);
+  if (!sync_dirty ())
+    PANIC ("can't write free map");
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,14 +303,309 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  lock_acquire (&free_map_lock);
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+  free_map_file = file;
+  lock_release (&free_map_lock);
+}
+
+/* Returns a hash value for extent E's first sector. */
+static unsigned
+extent_start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct extent, start_elem)->start);
+}
+
+/* Returns true if extent A starts before extent B. */
+static bool
+extent_start_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                   void *aux UNUSED)
+{
+  const struct extent *a = hash_entry (a_, struct extent, start_elem);
+  const struct extent *b = hash_entry (b_, struct extent, start_elem);
+  return a->start < b->start;
+}
+
+/* Returns a hash value for the sector just past extent E. */
+static unsigned
+extent_end_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct extent *e = hash_entry (e_, struct extent, end_elem);
+  return hash_int (e->start + e->length);
+}
+
+/* Returns true if extent A ends before extent B. */
+static bool
+extent_end_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                 void *aux UNUSED)
+{
+  const struct extent *a = hash_entry (a_, struct extent, end_elem);
+  const struct extent *b = hash_entry (b_, struct extent, end_elem);
+  return a->start + a->length < b->start + b->length;
+}
+
+/* Returns the size class for an extent LENGTH sectors long. */
+static size_t
+size_class (size_t length) 
+{
+  size_t k = 0;
+  while (k + 1 < SIZE_CLASS_CNT && length >> (k + 1) != 0)
+    k++;
+  return k;
+}
+
+/* Returns the list for size class K of locality group GROUP. */
+static struct list *
+class_list (size_t group, size_t k) 
+{
+  return &class_lists[group * SIZE_CLASS_CNT + k];
+}
+
+/* Adds E to the index. */
+static void
+extent_insert (struct extent *e) 
+{
+  hash_insert (&extents_by_start, &e->start_elem);
+  hash_insert (&extents_by_end, &e->end_elem);
+  list_push_back (class_list (e->start / GROUP_SECTORS, size_class (e->length)),
+                  &e->list_elem);
+}
+
+/* Removes E from the index. */
+static void
+extent_remove (struct extent *e) 
+{
+  hash_delete (&extents_by_start, &e->start_elem);
+  hash_delete (&extents_by_end, &e->end_elem);
+  list_remove (&e->list_elem);
+}
+
+/* Creates and indexes an extent of LENGTH sectors starting at
+   START.  Marks the index stale if memory runs out. */
+static void
+extent_create (block_sector_t start, size_t length) 
+{
+  struct extent *e = malloc (sizeof *e);
+  if (e == NULL)
+    {
+      index_stale = true;
+      return;
+    }
+  e->start = start;
+  e->length = length;
+  extent_insert (e);
+}
+
+/* Returns the extent that starts at SECTOR, if any. */
+static struct extent *
+extent_starting_at (block_sector_t sector) 
+{
+  struct extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  e = hash_find (&extents_by_start, &key.start_elem);
+  return e != NULL ? hash_entry (e, struct extent, start_elem) : NULL;
+}
+
+/* Returns the extent that ends just before SECTOR, if any. */
+static struct extent *
+extent_ending_at (block_sector_t sector) 
+{
+  struct extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  key.length = 0;
+  e = hash_find (&extents_by_end, &key.end_elem);
+  return e != NULL ? hash_entry (e, struct extent, end_elem) : NULL;
+}
+
+/* Returns the extent containing free SECTOR, or a null pointer
+   if SECTOR is in use or the start of its extent is more than a
+   group away. */
+static struct extent *
+extent_containing (block_sector_t sector) 
+{
+  block_sector_t start = sector;
+
+  if (bitmap_test (free_map, sector))
+    return NULL;
+  while (start > 0 && sector - start < GROUP_SECTORS
+         && !bitmap_test (free_map, start - 1))
+    start--;
+  return extent_starting_at (start);
+}
+
+/* Frees extent E, which is not in the index. */
+static void
+extent_free (struct hash_elem *e, void *aux UNUSED) 
+{
+  free (hash_entry (e, struct extent, start_elem));
+}
+
+/* Discards the index and builds it again from the bitmap. */
+static void
+index_rebuild (void) 
+{
+  size_t size = bitmap_size (free_map);
+  size_t start = 0;
+  size_t i;
+
+  hash_clear (&extents_by_end, NULL);
+  hash_clear (&extents_by_start, extent_free);
+  for (i = 0; i < group_cnt * SIZE_CLASS_CNT; i++)
+    list_init (&class_lists[i]);
+  index_stale = false;
+
+  while (start < size
+         && (start = bitmap_scan (free_map, start, 1, false)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      extent_create (start, end - start);
+      start = end;
+    }
+}
+
+/* Marks the CNT sectors starting at SECTOR, which lie within
+   extent E, as in use, and updates the index. */
+static void
+extent_take (struct extent *e, block_sector_t sector, size_t cnt) 
+{
+  block_sector_t end = e->start + e->length;
+
+  ASSERT (sector >= e->start && sector + cnt <= end);
+
+  extent_remove (e);
+  if (sector > e->start)
+    {
+      /* Keep the part before SECTOR, and add any part after. */
+      e->length = sector - e->start;
+      extent_insert (e);
+      if (sector + cnt < end)
+        extent_create (sector + cnt, end - (sector + cnt));
+    }
+  else if (sector + cnt < end)
+    {
+      e->start = sector + cnt;
+      e->length = end - e->start;
+      extent_insert (e);
+    }
+  else
+    free (e);
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  mark_dirty (sector, cnt);
+}
+
+/* Returns the first extent in locality group GROUP with at least
+   CNT sectors, or a null pointer if there is none. */
+static struct extent *
+group_fit (size_t group, size_t cnt) 
+{
+  size_t k;
+
+  for (k = size_class (cnt); k < SIZE_CLASS_CNT; k++)
+    {
+      struct list *l = class_list (group, k);
+      struct list_elem *le;
+
+      for (le = list_begin (l); le != list_end (l); le = list_next (le))
+        {
+          struct extent *e = list_entry (le, struct extent, list_elem);
+          if (e->length >= cnt)
+            return e;
+        }
+    }
+  return NULL;
+}
+
+/* Allocates CNT sectors as close to GOAL as possible using the
+   index.  Returns the first sector, or BITMAP_ERROR if there is
+   no free run of CNT sectors. */
+static block_sector_t
+index_allocate (block_sector_t goal, size_t cnt) 
+{
+  struct extent *e;
+  size_t home, d;
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+
+  /* Right at the goal. */
+  e = extent_containing (goal);
+  if (e != NULL && e->start + e->length >= goal + cnt)
+    {
+      extent_take (e, goal, cnt);
+      goal_cnt++;
+      return goal;
+    }
+
+  /* In the goal's group, then in groups D away on either side. */
+  home = goal / GROUP_SECTORS;
+  for (d = 0; d < group_cnt; d++)
+    {
+      e = NULL;
+      if (home + d < group_cnt)
+        e = group_fit (home + d, cnt);
+      if (e == NULL && d > 0 && d <= home)
+        e = group_fit (home - d, cnt);
+      if (e != NULL)
+        {
+          block_sector_t sector = e->start;
+          if (d == 0)
+            group_hit_cnt++;
+          extent_take (e, sector, cnt);
+          return sector;
+        }
+      if (home + d >= group_cnt && d >= home)
+        break;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Adds the CNT sectors starting at SECTOR, which were just
+   freed, to the index, merging them with the extents on either
+   side. */
+static void
+index_release (block_sector_t sector, size_t cnt) 
+{
+  struct extent *before = extent_ending_at (sector);
+  struct extent *after = extent_starting_at (sector + cnt);
+
+  if (before != NULL)
+    {
+      extent_remove (before);
+      before->length += cnt;
+      if (after != NULL)
+        {
+          extent_remove (after);
+          before->length += after->length;
+          free (after);
+        }
+      extent_insert (before);
+    }
+  else if (after != NULL)
+    {
+      extent_remove (after);
+      after->start = sector;
+      after->length += cnt;
+      extent_insert (after);
+    }
+  else
+    extent_create (sector, cnt);
 }
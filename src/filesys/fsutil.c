@@ -7,6 +7,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -220,3 +221,12 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* Prints statistics on the fragmentation of free space in the
+   file system. */
+void
+fsutil_frag (char **argv UNUSED) 
+{
+  printf ("Free space fragmentation:\n");
+  free_map_print_stats ();
+}
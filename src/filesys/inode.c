@@ -1,25 +1,73 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Block pointers in an inode.  The first DIRECT_CNT point to
+   data sectors, the next one to an indirect sector of pointers
+   to data sectors, and the last to a doubly indirect sector of
+   pointers to indirect sectors.  A pointer of 0 means that the
+   sector has not been allocated, and reads back as zeros. */
+#define DIRECT_CNT 123
+#define INDIRECT_IDX DIRECT_CNT
+#define DOUBLY_INDIRECT_IDX (DIRECT_CNT + 1)
+#define POINTER_CNT (DIRECT_CNT + 2)
+
+/* Number of block pointers in an indirect sector. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Set in a pointer to a data sector that has been allocated but
+   never written.  Such a sector reads back as zeros, like a hole,
+   and is only zeroed on disk when it is first written, so that
+   creating a large file doesn't have to write all of it. */
+#define UNWRITTEN_BIT 0x80000000u
+
+/* What byte_to_sector() does about missing sectors. */
+enum map_mode
+  {
+    MAP_LOOKUP,                 /* Leave them missing. */
+    MAP_RESERVE,                /* Allocate them, leaving data sectors
+                                   unwritten. */
+    MAP_WRITE                   /* Allocate them, and zero data sectors
+                                   that are unwritten. */
+  };
+
+/* Largest file whose data is kept in the inode itself, in the
+   space used for block pointers by larger files. */
+#define INLINE_MAX (POINTER_CNT * sizeof (block_sector_t))
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is in the inode. */
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t sectors[POINTER_CNT]; /* Block pointers, or the data
+                                           itself if INODE_INLINE. */
     off_t length;                       /* File size in bytes. */
+    unsigned flags;                     /* INODE_* flags. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
+/* Returns the data of the inline file described by DATA.  Bytes
+   past the end of the file are kept zeroed. */
+static inline uint8_t *
+inline_data (struct inode_disk *data) 
+{
+  ASSERT (data->flags & INODE_INLINE);
+  return (uint8_t *) data->sectors;
+}
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -31,42 +79,213 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    /* Protected by open_inodes_lock. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+
+    /* Protected by LOCK.  Sectors of file data are protected by
+       the buffer cache instead, so LOCK is never held while
+       copying file data, which may fault on user memory. */
+    struct lock lock;                   /* Guards the fields below. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+    block_sector_t alloc_goal;          /* Last sector allocated, which the
+                                           next allocation tries to
+                                           follow. */
+    bool loaded;                        /* DATA read from disk yet? */
+    struct inode_disk *data;            /* Inode content, allocated along
+                                           with the inode but only read on
+                                           first use. */
+
+    struct lock user_lock;              /* See inode_lock(). */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+/* Returns INODE's on-disk inode, reading it in if it has not been
+   read since INODE was opened.  INODE's lock must be held. */
+static struct inode_disk *
+get_data (struct inode *inode) 
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (!inode->loaded)
+    {
+      cache_read (inode->sector, inode->data);
+      inode->loaded = true;
+    }
+  return inode->data;
+}
+
+/* Applies MODE to block pointer *PTR, which points to a data
+   sector if LEAF is true or to an indirect sector otherwise.
+   Sectors are allocated right after *GOAL if possible, and *GOAL
+   is advanced to them.  Indirect sectors are always zeroed when
+   they are allocated, since their pointers must read as 0.
+   Returns true if successful, false if the disk is full. */
+static bool
+map_pointer (block_sector_t *ptr, bool leaf, enum map_mode mode,
+             block_sector_t *goal)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (mode == MAP_LOOKUP)
+    return true;
+
+  if (*ptr == 0)
+    {
+      block_sector_t sector;
+
+      if (!free_map_allocate_near (*goal + 1, 1, &sector))
+        return false;
+      *goal = sector;
+      if (leaf)
+        *ptr = sector | UNWRITTEN_BIT;
+      else
+        {
+          cache_write (sector, zeros);
+          *ptr = sector;
+        }
+    }
+
+  /* The zeros only go into the buffer cache, and are usually
+     overwritten there by the caller's data before they could be
+     written back. */
+  if (mode == MAP_WRITE && (*ptr & UNWRITTEN_BIT))
+    {
+      *ptr &= ~UNWRITTEN_BIT;
+      cache_write (*ptr, zeros);
+    }
+  return true;
+}
+
+/* Stores into *SECTORP the block device sector that holds byte
+   offset POS within the file described by DATA, or 0 if that
+   sector is missing or unwritten, so that it reads as zeros.
+   Missing sectors are allocated according to MODE, near *GOAL,
+   which is advanced past them; GOAL may be null for MAP_LOOKUP.
+   Pointers in DATA itself are updated in memory only.
+   Returns false if POS is beyond the largest possible file or
+   if a sector could not be allocated, true otherwise. */
+static bool
+byte_to_sector (struct inode_disk *data, off_t pos, enum map_mode mode,
+                block_sector_t *goal, block_sector_t *sectorp)
+{
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  size_t root, span;
+  block_sector_t sector;
+  int level;
+
+  ASSERT (data != NULL);
+  ASSERT (pos >= 0);
+
+  /* Find the pointer in DATA at the root of IDX's tree, its
+     depth, and the number of data sectors below each pointer
+     one level down. */
+  if (idx < DIRECT_CNT)
+    {
+      root = idx;
+      level = 0;
+      span = 1;
+    }
+  else if ((idx -= DIRECT_CNT) < PTRS_PER_SECTOR)
+    {
+      root = INDIRECT_IDX;
+      level = 1;
+      span = PTRS_PER_SECTOR;
+    }
+  else if ((idx -= PTRS_PER_SECTOR) < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      root = DOUBLY_INDIRECT_IDX;
+      level = 2;
+      span = PTRS_PER_SECTOR * PTRS_PER_SECTOR;
+    }
   else
-    return -1;
+    return false;
+
+  if (!map_pointer (&data->sectors[root], level == 0, mode, goal))
+    return false;
+  sector = data->sectors[root];
+
+  /* Walk down through the indirect sectors. */
+  while (level-- > 0 && sector != 0)
+    {
+      size_t ofs;
+      block_sector_t next, old;
+
+      span /= PTRS_PER_SECTOR;
+      ofs = idx / span % PTRS_PER_SECTOR * sizeof next;
+      cache_read_at (sector, &next, ofs, sizeof next);
+      old = next;
+      if (!map_pointer (&next, level == 0, mode, goal))
+        return false;
+      if (next != old)
+        cache_write_at (sector, &next, ofs, sizeof next);
+      sector = next;
+    }
+
+  *sectorp = sector & UNWRITTEN_BIT ? 0 : sector;
+  return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Frees SECTOR, and if LEVEL is greater than 0, the LEVEL levels
+   of indirect and data sectors below it. */
+static void
+release_tree (block_sector_t sector, int level)
+{
+  sector &= ~UNWRITTEN_BIT;
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      size_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t child;
+
+          cache_read_at (sector, &child, i * sizeof child, sizeof child);
+          release_tree (child, level - 1);
+        }
+    }
+  free_map_release (sector, 1);
+}
+
+/* Frees all the data and indirect sectors of DATA. */
+static void
+release_sectors (struct inode_disk *data)
+{
+  size_t i;
+
+  if (data->flags & INODE_INLINE)
+    return;
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_tree (data->sectors[i], 0);
+  release_tree (data->sectors[INDIRECT_IDX], 1);
+  release_tree (data->sectors[DOUBLY_INDIRECT_IDX], 2);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open counts of the inodes in it. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  If LENGTH is small enough, the data is kept in the
+   inode itself.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -85,59 +304,80 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      block_sector_t goal = sector;
+      size_t i;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if ((size_t) length <= INLINE_MAX)
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
+          disk_inode->flags = INODE_INLINE;
+          sectors = 0;
+        }
+
+      /* Allocate the data sectors up front, so that they are laid
+         out one after another following the inode, but leave them
+         unwritten until they are written to. */
+      success = true;
+      for (i = 0; i < sectors; i++)
+        {
+          block_sector_t data_sector;
+          if (!byte_to_sector (disk_inode, i * BLOCK_SECTOR_SIZE,
+                               MAP_RESERVE, &goal, &data_sector))
             {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
+              release_sectors (disk_inode);
+              success = false;
+              break;
             }
-          success = true; 
-        } 
+        }
+      if (success)
+        cache_write (sector, disk_inode);
       free (disk_inode);
     }
   return success;
 }
 
-/* Reads an inode from SECTOR
-   and returns a `struct inode' that contains it.
+/* Returns a `struct inode' for the inode in SECTOR.  The inode
+   itself is not read from disk until it is first needed.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      goto done;
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = malloc (sizeof *inode + sizeof *inode->data);
   if (inode == NULL)
-    return NULL;
+    goto done;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  lock_init (&inode->lock);
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->alloc_goal = sector;
+  inode->loaded = false;
+  inode->data = (struct inode_disk *) (inode + 1);
+  lock_init (&inode->user_lock);
+  hash_insert (&open_inodes, &inode->elem);
+
+ done:
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +386,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,23 +407,30 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Release resources if this was the last opener.  Nobody else
+     can reach INODE any more. */
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
+      lock_acquire (&inode->lock);
       if (inode->removed) 
         {
+          release_sectors (get_data (inode));
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
         }
+      lock_release (&inode->lock);
 
       free (inode); 
     }
@@ -191,128 +442,299 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode->lock);
   inode->removed = true;
+  lock_release (&inode->lock);
+}
+
+/* Acquires INODE's user lock.  This lock is for the users of an
+   inode, such as directories, to keep the structures they store
+   in its data consistent; the inode functions never take it, so
+   it may be held across calls to them. */
+void
+inode_lock (struct inode *inode) 
+{
+  lock_acquire (&inode->user_lock);
+}
+
+/* Releases INODE's user lock. */
+void
+inode_unlock (struct inode *inode) 
+{
+  lock_release (&inode->user_lock);
+}
+
+/* Moves the data of INODE, which must be inline, out to a data
+   sector of its own, so that the file can grow past INLINE_MAX
+   bytes.  INODE's lock must be held.
+   Returns true if successful, false if the disk is full. */
+static bool
+promote (struct inode *inode) 
+{
+  struct inode_disk *data = get_data (inode);
+  block_sector_t sector = 0;
+
+  if (data->length > 0)
+    {
+      if (!map_pointer (&sector, true, MAP_WRITE, &inode->alloc_goal))
+        return false;
+      cache_write_at (sector, inline_data (data), 0, data->length);
+    }
+  memset (data->sectors, 0, sizeof data->sectors);
+  data->sectors[0] = sector;
+  data->flags &= ~INODE_INLINE;
+  cache_write (inode->sector, data);
+  return true;
+}
+
+/* Returns true if INODE's data is inline.  Once an inode's data
+   has been moved out to blocks it never comes back, so a false
+   result stays true. */
+static bool
+is_inline (struct inode *inode) 
+{
+  bool result;
+
+  lock_acquire (&inode->lock);
+  result = (get_data (inode)->flags & INODE_INLINE) != 0;
+  lock_release (&inode->lock);
+  return result;
+}
+
+/* If INODE's data is inline, reads up to SIZE bytes from it at
+   OFFSET into BUFFER, stores the number of bytes read in
+   *BYTES_READ, and returns true.  Returns false if INODE's data
+   is in blocks instead.
+   BUFFER may be in user memory, so the data is copied out
+   through a bounce buffer rather than with INODE's lock held. */
+static bool
+read_inline (struct inode *inode, void *buffer, off_t size, off_t offset,
+             off_t *bytes_read) 
+{
+  struct inode_disk *data;
+  uint8_t *bounce = NULL;
+
+  lock_acquire (&inode->lock);
+  data = get_data (inode);
+  if (!(data->flags & INODE_INLINE))
+    {
+      lock_release (&inode->lock);
+      return false;
+    }
+  if (offset >= data->length)
+    size = 0;
+  else if (size > data->length - offset)
+    size = data->length - offset;
+  if (size > 0)
+    {
+      bounce = malloc (size);
+      if (bounce != NULL)
+        memcpy (bounce, inline_data (data) + offset, size);
+    }
+  lock_release (&inode->lock);
+
+  *bytes_read = 0;
+  if (bounce != NULL)
+    {
+      memcpy (buffer, bounce, size);
+      free (bounce);
+      *bytes_read = size;
+    }
+  return true;
+}
+
+/* If INODE's data is inline, writes SIZE bytes from BUFFER into
+   it at OFFSET, stores the number of bytes written in
+   *BYTES_WRITTEN, and returns true.  Returns false if INODE's
+   data is in blocks, first moving it there if the write would
+   not fit inline.
+   BUFFER may be in user memory, so it is copied in through a
+   bounce buffer rather than with INODE's lock held. */
+static bool
+write_inline (struct inode *inode, const void *buffer, off_t size,
+              off_t offset, off_t *bytes_written) 
+{
+  bool fits = (size_t) offset + size <= INLINE_MAX;
+  struct inode_disk *data;
+  uint8_t *bounce = NULL;
+  bool done = true;
+
+  if (!is_inline (inode))
+    return false;
+
+  *bytes_written = 0;
+  if (fits)
+    {
+      bounce = malloc (size);
+      if (bounce == NULL)
+        return true;
+      memcpy (bounce, buffer, size);
+    }
+
+  /* Check again, since another writer may have moved the data
+     out while we didn't hold the lock. */
+  lock_acquire (&inode->lock);
+  data = get_data (inode);
+  if (!(data->flags & INODE_INLINE))
+    done = false;
+  else if (fits)
+    {
+      memcpy (inline_data (data) + offset, bounce, size);
+      if (offset + size > data->length)
+        data->length = offset + size;
+      cache_write (inode->sector, data);
+      *bytes_written = size;
+    }
+  else if (promote (inode))
+    done = false;
+  lock_release (&inode->lock);
+
+  free (bounce);
+  return done;
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Parts of the file that were never written read as zeros. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  if (size > 0 && read_inline (inode, buffer, size, offset, &bytes_read))
+    return bytes_read;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t inode_left;
+      int sector_left, min_left, chunk_size;
+      bool mapped;
+
+      lock_acquire (&inode->lock);
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      inode_left = get_data (inode)->length - offset;
+      sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      chunk_size = size < min_left ? size : min_left;
+      mapped = (chunk_size > 0
+                && byte_to_sector (get_data (inode), offset, MAP_LOOKUP,
+                                   NULL, &sector_idx));
+      lock_release (&inode->lock);
+      if (!mapped)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* Reads tend to be sequential, so start bringing in the next
+     sector. */
+  if (bytes_read > 0)
+    {
+      block_sector_t next_sector = 0;
+
+      lock_acquire (&inode->lock);
+      if (offset < get_data (inode)->length
+          && !byte_to_sector (get_data (inode), offset, MAP_LOOKUP, NULL,
+                              &next_sector))
+        next_sector = 0;
+      lock_release (&inode->lock);
+      if (next_sector != 0)
+        cache_read_ahead (next_sector);
+    }
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends the inode.  Only the sectors
+   written to are allocated, so any gap left before OFFSET reads
+   as zeros without taking up space.  The new length is only
+   published once the data is in place, so concurrent readers
+   never see the extension before its contents. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool allocated = false;
+  bool denied;
 
-  if (inode->deny_write_cnt)
+  lock_acquire (&inode->lock);
+  denied = inode->deny_write_cnt > 0;
+  lock_release (&inode->lock);
+  if (denied)
     return 0;
 
+  if (size > 0 && write_inline (inode, buffer, size, offset, &bytes_written))
+    return bytes_written;
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      bool mapped;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      /* Sectors that are missing or unwritten have to be
+         allocated or zeroed first, which changes the block
+         pointers. */
+      lock_acquire (&inode->lock);
+      mapped = byte_to_sector (get_data (inode), offset, MAP_LOOKUP, NULL,
+                               &sector_idx);
+      if (mapped && sector_idx == 0)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          mapped = byte_to_sector (get_data (inode), offset, MAP_WRITE,
+                                   &inode->alloc_goal, &sector_idx);
+          allocated = true;
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      lock_release (&inode->lock);
+      if (!mapped)
+        break;
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file, and write back the inode if it grew or its
+     block pointers changed. */
+  lock_acquire (&inode->lock);
+  if (bytes_written > 0 && offset > get_data (inode)->length)
+    {
+      get_data (inode)->length = offset;
+      allocated = true;
+    }
+  if (allocated)
+    cache_write (inode->sector, get_data (inode));
+  lock_release (&inode->lock);
 
   return bytes_written;
 }
@@ -322,8 +744,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +756,42 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
-inode_length (const struct inode *inode)
+inode_length (const struct inode *inode_)
+{
+  /* Reading in the on-disk inode and taking its lock don't change
+     INODE in any way that callers can see. */
+  struct inode *inode = (struct inode *) inode_;
+  off_t length;
+
+  lock_acquire (&inode->lock);
+  length = get_data (inode)->length;
+  lock_release (&inode->lock);
+  return length;
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
 {
-  return inode->data.length;
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
 }
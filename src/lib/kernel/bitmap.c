@@ -27,6 +27,7 @@ typedef unsigned long elem_type;
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
+    size_t next_fit;    /* Where bitmap_scan_and_flip_next() starts. */
     elem_type *bits;    /* Elements that represent bits. */
   };
 
@@ -68,6 +69,101 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns an elem_type in which the bits corresponding to BIT_IDX
+   and everything after it in the same element are turned on. */
+static inline elem_type
+from_mask (size_t bit_idx)
+{
+  return (elem_type) -1 << (bit_idx % ELEM_BITS);
+}
+
+/* Returns an elem_type in which the bits corresponding to
+   everything before BIT_IDX in the same element are turned on,
+   or every bit if BIT_IDX is the first bit of an element. */
+static inline elem_type
+before_mask (size_t bit_idx)
+{
+  return bit_idx % ELEM_BITS ? ~from_mask (bit_idx) : (elem_type) -1;
+}
+
+/* Returns element IDX of B, inverted if VALUE is false, so that
+   the bits set in the result are those equal to VALUE. */
+static inline elem_type
+elem_matching (const struct bitmap *b, size_t idx, bool value)
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of bits set in X. */
+static inline size_t
+count_ones (elem_type x)
+{
+  /* The kernel doesn't link against libgcc, so
+     __builtin_popcountl() is not available.  Add up the bits in
+     pairs, then nibbles, then sum the bytes with a multiply. */
+  x = x - ((x >> 1) & (elem_type) 0x5555555555555555ULL);
+  x = (x & (elem_type) 0x3333333333333333ULL)
+      + ((x >> 2) & (elem_type) 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & (elem_type) 0x0f0f0f0f0f0f0f0fULL;
+  return (elem_type) (x * (elem_type) 0x0101010101010101ULL)
+         >> (ELEM_BITS - CHAR_BIT);
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Works an element at a time, so that runs of bits not set to
+   VALUE are passed over ELEM_BITS at a time. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx = elem_idx (start);
+  elem_type word;
+
+  if (start >= end)
+    return end;
+
+  word = elem_matching (b, idx, value) & from_mask (start);
+  while (word == 0)
+    {
+      if (++idx >= elem_cnt (end))
+        return end;
+      word = elem_matching (b, idx, value);
+    }
+
+  start = idx * ELEM_BITS + __builtin_ctzl (word);
+  return start < end ? start : end;
+}
+
+/* Returns the starting index of the first group of CNT
+   consecutive bits in B that are all set to VALUE and lie
+   entirely at or after START and before END, or BITMAP_ERROR if
+   there is no such group. */
+static size_t
+scan_range (const struct bitmap *b, size_t start, size_t end, size_t cnt,
+            bool value)
+{
+  if (cnt == 0)
+    return start <= end ? start : BITMAP_ERROR;
+
+  for (;;)
+    {
+      size_t mismatch;
+
+      /* Skip to the next bit that could begin a group. */
+      start = find_next (b, start, end, value);
+      if (cnt > end - start)
+        return BITMAP_ERROR;
+
+      /* The group starting there is good unless it contains a
+         bit set to !VALUE, in which case no group can start
+         before the bit after that one. */
+      mismatch = find_next (b, start, start + cnt, !value);
+      if (mismatch == start + cnt)
+        return start;
+      start = mismatch + 1;
+    }
+}
 
 /* Creation and destruction. */
 
@@ -82,6 +178,7 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->next_fit = 0;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -104,6 +201,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->next_fit = 0;
   b->bits = (elem_type *) (b + 1);
   bitmap_set_all (b, false);
   return b;
@@ -233,16 +331,26 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end, first, last, idx, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  if (cnt == 0)
+    return 0;
+
+  end = start + cnt;
+  first = elem_idx (start);
+  last = elem_idx (end - 1);
+  if (first == last)
+    return count_ones (elem_matching (b, first, value)
+                       & from_mask (start) & before_mask (end));
+
+  value_cnt = count_ones (elem_matching (b, first, value) & from_mask (start));
+  for (idx = first + 1; idx < last; idx++)
+    value_cnt += count_ones (elem_matching (b, idx, value));
+  value_cnt += count_ones (elem_matching (b, last, value) & before_mask (end));
   return value_cnt;
 }
 
@@ -251,16 +359,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,15 +402,7 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
-    {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
-    }
-  return BITMAP_ERROR;
+  return scan_range (b, start, b->bit_cnt, cnt, value);
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -325,6 +420,36 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but instead of starting at a
+   given index, starts just past the group returned by the
+   previous call on B and wraps around to the beginning of B if
+   necessary ("next fit").  Repeated allocations from a bitmap
+   that fills up from the front then don't have to pass over all
+   of its used bits each time. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t start, idx;
+
+  ASSERT (b != NULL);
+
+  start = b->next_fit <= b->bit_cnt ? b->next_fit : 0;
+  idx = scan_range (b, start, b->bit_cnt, cnt, value);
+  if (idx == BITMAP_ERROR && start > 0)
+    {
+      /* Groups that start before START, including any that
+         straddle it. */
+      size_t end = start + cnt - 1 < b->bit_cnt ? start + cnt - 1 : b->bit_cnt;
+      idx = scan_range (b, 0, end, cnt, value);
+    }
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->next_fit = idx + cnt;
+    }
+  return idx;
+}
 
 /* File input and output. */
 
@@ -359,6 +484,29 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B holding the CNT bits starting at START to
+   the same place in FILE, which must already hold the rest of B.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,60 @@
+/* Creates many files in the root directory, opens each of them
+   by name, and then removes them all.  Besides checking that
+   large directories work, this serves as a benchmark of
+   directory lookups: compare the timer ticks and block and cache
+   statistics that the kernel prints at shutdown. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 500
+
+static void
+make_name (char name[16], int i) 
+{
+  snprintf (name, 16, "file%d", i);
+}
+
+void
+test_main (void) 
+{
+  char name[16];
+  int i;
+
+  msg ("creating %d files", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      make_name (name, i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+    }
+  quiet = false;
+
+  msg ("opening %d files", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int fd;
+
+      make_name (name, i);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      close (fd);
+    }
+  quiet = false;
+
+  CHECK (open ("file-none") == -1, "open \"file-none\" (must fail)");
+  CHECK (!create ("file0", 0), "create \"file0\" again (must fail)");
+
+  msg ("removing %d files", FILE_CNT);
+  quiet = true;
+  for (i = FILE_CNT - 1; i >= 0; i--)
+    {
+      make_name (name, i);
+      CHECK (remove (name), "remove \"%s\"", name);
+    }
+  quiet = false;
+
+  CHECK (open ("file0") == -1, "open \"file0\" (must fail)");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-many) begin
+(dir-many) creating 500 files
+(dir-many) opening 500 files
+(dir-many) open "file-none" (must fail)
+(dir-many) create "file0" again (must fail)
+(dir-many) removing 500 files
+(dir-many) open "file0" (must fail)
+(dir-many) end
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Spawns several child processes, each of which writes, checks
+   and then repeatedly reads back a file of its own, and waits for
+   them to finish.  Then checks the contents of every file again.
+   The test passes only if every child and every check succeeds.
+
+   None of the children touch the same file, so with fine-grained
+   file system locking they should never have to wait for each
+   other except at the disk.  Together the files are larger than
+   the buffer cache, so the children keep going to disk.  The
+   timer ticks the kernel prints at shutdown, which the expected
+   output does not cover, show how much the children overlap. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/base/syn-indep.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char file_name[16];
+  size_t i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "indep%zu", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+    }
+
+  exec_children ("child-syn-indep", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "indep%zu", i);
+      random_init (i);
+      random_bytes (buf, sizeof buf);
+      check_file (file_name, buf, sizeof buf);
+    }
+}
@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-indep) begin
+(syn-indep) create "indep0"
+(syn-indep) create "indep1"
+(syn-indep) create "indep2"
+(syn-indep) create "indep3"
+(syn-indep) exec child 1 of 4: "child-syn-indep 0"
+(syn-indep) exec child 2 of 4: "child-syn-indep 1"
+(syn-indep) exec child 3 of 4: "child-syn-indep 2"
+(syn-indep) exec child 4 of 4: "child-syn-indep 3"
+(syn-indep) wait for child 1 of 4 returned 0 (expected 0)
+(syn-indep) wait for child 2 of 4 returned 1 (expected 1)
+(syn-indep) wait for child 3 of 4 returned 2 (expected 2)
+(syn-indep) wait for child 4 of 4 returned 3 (expected 3)
+(syn-indep) open "indep0" for verification
+(syn-indep) verified contents of "indep0"
+(syn-indep) close "indep0"
+(syn-indep) open "indep1" for verification
+(syn-indep) verified contents of "indep1"
+(syn-indep) close "indep1"
+(syn-indep) open "indep2" for verification
+(syn-indep) verified contents of "indep2"
+(syn-indep) close "indep2"
+(syn-indep) open "indep3" for verification
+(syn-indep) verified contents of "indep3"
+(syn-indep) close "indep3"
+(syn-indep) end
+EOF
+pass;
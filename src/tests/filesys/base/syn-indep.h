@@ -0,0 +1,9 @@
+#ifndef TESTS_FILESYS_BASE_SYN_INDEP_H
+#define TESTS_FILESYS_BASE_SYN_INDEP_H
+
+#define CHILD_CNT 4
+#define CHUNK_SIZE 512
+#define BUF_SIZE (48 * CHUNK_SIZE)
+#define PASS_CNT 4
+
+#endif /* tests/filesys/base/syn-indep.h */
@@ -0,0 +1,212 @@
+/* Test program and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), bitmap_contains() and
+   bitmap_scan_and_flip_next() against straightforward bit-by-bit
+   versions.  Then, on a large bitmap that is mostly full, which
+   is the case that matters for the page allocator, the free map
+   and swap, times bitmap_scan() against a bit-by-bit scan from
+   the same starting points, and separately times allocation by
+   restarting each scan from bit 0 against the next fit of
+   bitmap_scan_and_flip_next().
+
+   This is not a test we will run on your submitted tasks.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Largest bitmap used for checking. */
+#define CHECK_BITS 300
+
+/* Size of the bitmap used for timing, in bits. */
+#define BENCH_BITS (1 << 16)
+
+/* Number of scans timed for each implementation. */
+#define BENCH_SCANS 256
+
+/* Number of allocations timed for each allocation strategy. */
+#define BENCH_ALLOCS 256
+
+static void check (void);
+static void bench (void);
+static void fill (struct bitmap *, int percent);
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool);
+
+/* Test and time the bitmap implementation. */
+void
+test (void)
+{
+  check ();
+  bench ();
+  printf ("bitmap: PASS\n");
+}
+
+/* Compares the bitmap operations against their bit-by-bit
+   equivalents on random bitmaps of various sizes and
+   densities. */
+static void
+check (void)
+{
+  size_t bit_cnt;
+
+  printf ("testing various size bitmaps:");
+  for (bit_cnt = 0; bit_cnt < CHECK_BITS; bit_cnt += 7)
+    {
+      struct bitmap *b = bitmap_create (bit_cnt);
+      int repeat;
+
+      ASSERT (b != NULL);
+      printf (" %zu", bit_cnt);
+      for (repeat = 0; repeat < 10; repeat++)
+        {
+          int query;
+
+          fill (b, random_ulong () % 101);
+          for (query = 0; query < 50; query++)
+            {
+              size_t start = random_ulong () % (bit_cnt + 1);
+              size_t cnt = random_ulong () % (bit_cnt - start + 1);
+              size_t scan_cnt = random_ulong () % 16;
+              bool value = random_ulong () % 2;
+              size_t expected = slow_count (b, start, cnt, value);
+
+              ASSERT (bitmap_count (b, start, cnt, value) == expected);
+              ASSERT (bitmap_contains (b, start, cnt, value)
+                      == (expected > 0));
+              ASSERT (bitmap_scan (b, start, scan_cnt, value)
+                      == slow_scan (b, start, scan_cnt, value));
+            }
+
+          /* Next fit must find a group whenever one exists
+             anywhere in the bitmap. */
+          for (query = 0; query < 50; query++)
+            {
+              size_t cnt = random_ulong () % 8 + 1;
+              size_t expected = slow_scan (b, 0, cnt, false);
+              size_t idx = bitmap_scan_and_flip_next (b, cnt, false);
+
+              ASSERT ((idx == BITMAP_ERROR) == (expected == BITMAP_ERROR));
+              ASSERT (idx == BITMAP_ERROR || bitmap_all (b, idx, cnt));
+              if (bit_cnt > 0)
+                bitmap_reset (b, random_ulong () % bit_cnt);
+            }
+        }
+      bitmap_destroy (b);
+    }
+  printf (" done\n");
+}
+
+/* Runs the timings on a bitmap that is 95% full. */
+static void
+bench (void)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  int64_t start;
+  int64_t slow_ticks, fast_ticks;
+  size_t starts[BENCH_SCANS];
+  size_t slow_sum, fast_sum;
+  int i;
+
+  ASSERT (b != NULL);
+
+  /* Word at a time against bit by bit: the same searches, for a
+     group of 4 free bits, from the same random starting points on
+     the same bitmap, which is left unchanged. */
+  random_init (0);
+  fill (b, 95);
+  for (i = 0; i < BENCH_SCANS; i++)
+    starts[i] = random_ulong () % BENCH_BITS;
+
+  /* The results are summed and compared so that the scans can't
+     be optimized away. */
+  slow_sum = fast_sum = 0;
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    slow_sum += slow_scan (b, starts[i], 4, false);
+  slow_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    fast_sum += bitmap_scan (b, starts[i], 4, false);
+  fast_ticks = timer_elapsed (start);
+  ASSERT (slow_sum == fast_sum);
+
+  printf ("%d scans of %d-bit bitmap, 95%% full: "
+          "bit by bit %"PRId64" ticks, word at a time %"PRId64" ticks\n",
+          BENCH_SCANS, BENCH_BITS, slow_ticks, fast_ticks);
+
+  /* First fit against next fit: single-bit allocations from
+     identical bitmaps, both with the word-at-a-time scan. */
+  random_init (0);
+  fill (b, 95);
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ALLOCS; i++)
+    if (bitmap_scan_and_flip (b, 0, 1, false) == BITMAP_ERROR)
+      break;
+  slow_ticks = timer_elapsed (start);
+
+  random_init (0);
+  fill (b, 95);
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ALLOCS; i++)
+    if (bitmap_scan_and_flip_next (b, 1, false) == BITMAP_ERROR)
+      break;
+  fast_ticks = timer_elapsed (start);
+
+  printf ("%d allocations from %d-bit bitmap, 95%% full: "
+          "first fit from bit 0 %"PRId64" ticks, "
+          "next fit %"PRId64" ticks\n",
+          BENCH_ALLOCS, BENCH_BITS, slow_ticks, fast_ticks);
+  bitmap_destroy (b);
+}
+
+/* Sets about PERCENT percent of the bits in B to true, at
+   random. */
+static void
+fill (struct bitmap *b, int percent)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < percent);
+}
+
+/* Returns the number of the CNT bits in B starting at START
+   that are set to VALUE, testing one bit at a time. */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Returns the start of the first group of CNT bits in B at or
+   after START that are all set to VALUE, testing every candidate
+   group one bit at a time, as bitmap_scan() once did. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+
+      for (i = start; i <= last; i++)
+        if (slow_count (b, i, cnt, !value) == 0)
+          return i;
+    }
+  return BITMAP_ERROR;
+}
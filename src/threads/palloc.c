@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,7 +24,17 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool also keeps a count of its free pages, and a low and
+   a high watermark derived from its size.  The VM system starts
+   reclaiming user pages in the background when the number of
+   free ones falls below the low watermark, and stops once it is
+   back up to the high watermark. */
+
+/* Watermarks, as fractions of a pool's size. */
+#define LOW_WATER_DIVISOR 32
+#define HIGH_WATER_DIVISOR 16
 
 /* A memory pool. */
 struct pool
@@ -31,6 +42,9 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t free_cnt;                    /* Number of free pages. */
+    size_t low_water;                   /* Watermarks for free_cnt. */
+    size_t high_water;
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -78,7 +92,13 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  page_idx = bitmap_scan_and_flip_next (pool->used_map, page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    {
+      enum intr_level old_level = intr_disable ();
+      pool->free_cnt -= page_cnt;
+      intr_set_level (old_level);
+    }
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -119,6 +139,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -139,6 +160,12 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+
+  /* Pages may be freed with interrupts off, when the lock can't be
+     taken, so the count is protected by disabling interrupts. */
+  old_level = intr_disable ();
+  pool->free_cnt += page_cnt;
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,6 +175,35 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_free_cnt (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return pool->free_cnt;
+}
+
+/* Returns the low watermark for the number of free pages in the
+   user pool if PAL_USER is set in FLAGS, otherwise in the kernel
+   pool. */
+size_t
+palloc_low_water (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return pool->low_water;
+}
+
+/* Returns the high watermark for the number of free pages in the
+   user pool if PAL_USER is set in FLAGS, otherwise in the kernel
+   pool. */
+size_t
+palloc_high_water (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return pool->high_water;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -167,6 +223,9 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
+  p->low_water = page_cnt / LOW_WATER_DIVISOR + 1;
+  p->high_water = page_cnt / HIGH_WATER_DIVISOR + 2;
 }
 
 /* Returns true if PAGE was allocated from POOL,
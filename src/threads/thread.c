@@ -18,7 +18,6 @@
 #endif
 #ifdef VM
   #include "vm/page.h"
-  #include "vm/swap.h"
   #include "vm/mmap.h"
 #endif
 
@@ -258,7 +257,6 @@ thread_create (const char *name, int priority,
     palloc_free_page(t);
     return TID_ERROR;
   }
-  swap_table_init(&t->swap_table);
   #endif
 
   /* Prepare thread for first run by initializing its stack.
@@ -676,6 +674,7 @@ init_thread (struct thread *t, const char *name, int priority)
   }
 
   t->lock_to_acquire = NULL;
+  t->io_class = BLOCK_CLASS_SYNC;
   t->magic = THREAD_MAGIC;
   sema_init(&t->timer, 0);
 
@@ -690,7 +689,6 @@ init_thread (struct thread *t, const char *name, int priority)
   if (t != initial_thread) {
     supp_page_table_init(&t->supp_page_table);
     mapping_init(&t->mapid_page_table);
-    mmap_file_page_table_init(&t->mmap_file_page_table);
   }
   #endif
 
@@ -7,10 +7,14 @@
 #include <stdint.h>
 #include "threads/synch.h"
 #include "threads/fixed-point.h"
+#include "devices/block.h"
 #ifdef USERPROG
 #include <hash.h>
 #include "userprog/process.h"
 #endif
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -120,6 +124,10 @@ struct thread
     struct lock *lock_to_acquire;       /* Lock currently acquired by another
                                            thread */
 
+    /* Owned by devices/block.c. */
+    enum block_class io_class;          /* Class of the block reads that
+                                           the thread waits for. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory */
@@ -131,11 +139,9 @@ struct thread
 #endif
 
 #ifdef VM
-    struct hash supp_page_table;        /* Supplementary page table */
+    struct supp_page_table supp_page_table; /* Supplementary page table */
     struct hash mapid_page_table;       /* Mapping link between mapid and user
                                            virtual addresses */
-    struct hash mmap_file_page_table;   /* Memory mapped files */
-    struct hash swap_table;             /* Thread's swap table */
     void **esp;
 #endif
 
@@ -9,6 +9,7 @@
 #include "threads/vaddr.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/block.h"
 #include "filesys/file.h"
 #ifdef VM
   #include "vm/frame.h"
@@ -175,6 +176,10 @@ page_fault (struct intr_frame *f)
   /* If the page fault happened because of a syscall, use the saved esp */
   void *esp = (f->eip > PHYS_BASE ? *t->esp : f->esp);
 
+  /* Disk requests made to evict a page for this one and to fill it jump the
+     disk queue ahead of ordinary requests and write-back. */
+  enum block_class old_class = block_set_class(BLOCK_CLASS_FAULT);
+
   /* If the page doesn't exist, kill the process. */
   if (sp == NULL) {
     /* check whether it's a valid stack access */
@@ -182,13 +187,30 @@ page_fault (struct intr_frame *f)
       void *kaddr = frame_get_page(vaddr);
       supp_page_table_insert(&t->supp_page_table, vaddr, LOADED);
       install_page(vaddr, kaddr, true);
+      frame_unpin(kaddr);
     } else {
       kill(f);
     }
+    block_set_class(old_class);
   } else {
     char status[10];
+    swap_index_t swap_slot_read = BITMAP_ERROR;
+    /* The page may still be on its way out of a frame that another thread
+       is evicting it from. */
+    frame_wait_eviction(sp);
+
+    /* Read-only pages of an executable are shared between all the processes
+       running it, so another may already have this one in memory. */
+    struct inode *shared_inode = NULL;
+    if (sp->status == EXECUTABLE && !sp->writable) {
+      shared_inode = file_get_inode(sp->file);
+      if (frame_share_get(vaddr, shared_inode, sp->ofs)) {
+        block_set_class(old_class);
+        return;
+      }
+    }
+
     void *kaddr = frame_get_page(vaddr);
-    bool writable = true;
     switch (sp->status) {
       case ZEROED:
         /* page we got from frame_get_page is already zeroed! */
@@ -196,27 +218,35 @@ page_fault (struct intr_frame *f)
         break;
       case SWAPPED:
         /* Lazy load page data from swap table. */
-        swap_into_memory(&t->swap_table, vaddr, kaddr);
+        swap_slot_read = sp->swap_slot;
+        swap_into_memory(sp->swap_slot, kaddr);
+        sp->swap_slot = BITMAP_ERROR;
         sp->status = LOADED;
         break;
-      case MMAPPED:;
-        /* load in this page from the file */
-        struct mmap_file_page *found = mmap_file_page_table_get(
-            &t->mmap_file_page_table, vaddr);
-        writable = found->writable;
-        lock_filesys_access();
-        file_seek(found->file, found->ofs);
-        file_read(found->file, kaddr, found->size);
-        unlock_filesys_access();
-        sp->status = MMAPPED;
+      case MMAPPED:
+      case EXECUTABLE:
+        /* load in this page from the file.  The file may be in use by an
+           evictor at the same time, so don't touch its position. */
+        file_read_at(sp->file, kaddr, sp->read_bytes, sp->ofs);
         break;
       case LOADED:
+      case EVICTING:
         PANIC("There should be no page fault from page already in memory.");
       default:
         PANIC("unrecognised spt status!");
         NOT_REACHED();
     }
-    install_page(vaddr, kaddr, writable);
+    block_set_class(old_class);
+    install_page(vaddr, kaddr, sp->writable);
+    if (shared_inode != NULL) {
+      frame_share_publish(kaddr, shared_inode, sp->ofs);
+    }
+    frame_unpin(kaddr);
+
+    /* Bring in any pages swapped out alongside this one. */
+    if (swap_slot_read != BITMAP_ERROR) {
+      swap_read_ahead(vaddr, swap_slot_read);
+    }
   }
 
   /* 1. Locate page that faulted in SPT. If memory reference is valid, use the
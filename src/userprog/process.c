@@ -23,7 +23,6 @@
   #include "vm/page.h"
   #include "vm/frame.h"
   #include "vm/mmap.h"
-  #include "vm/swap.h"
 #endif
 
 #define MAX_FILE_NAME 16
@@ -39,7 +38,6 @@ static void read_args(char **argv, char **file_name, char *command_);
 static void push_args(struct intr_frame *if_, int argc, char **argv);
 static char* strcpy_stack(char *dst, char *src);
 static void push_word(uint32_t *word, struct intr_frame *if_);
-static void unmap_elem(struct hash_elem *elem, void *aux UNUSED);
 
 /* Starts a new thread running a command, with the program name as the first
    word and any arguments following it.
@@ -317,12 +315,9 @@ void
 process_exit (void)
 {
   struct thread *cur = thread_current();
+  struct file *executable = cur->process->executable;
   uint32_t *pd;
 
-  if (cur->process->executable != NULL) {
-    file_close(cur->process->executable);
-  }
-
   /* Notify all children that the parent thread is dead, and free all of the
    * child processes whose thread is no longer running. */
   while(!list_empty(&cur->child_processes)) {
@@ -353,14 +348,18 @@ process_exit (void)
   }
 
   #ifdef VM
-    /* Unmap all memory mapped files, Also, deletes all entries in
-       mmap_file_page_table. */
-    hash_apply(&cur->mapid_page_table, unmap_elem);
-    mmap_file_page_table_destroy(&cur->mmap_file_page_table);
+    /* Give up every page in one pass over the supplementary page table,
+       writing back memory mapped pages, then close the mapped files. */
     supp_page_table_destroy(&cur->supp_page_table);
-    swap_table_destroy(&cur->swap_table);
+    mapping_destroy(&cur->mapid_page_table);
   #endif
 
+  /* Only close the executable once its pages are gone, since while they are
+     shared its inode identifies them. */
+  if (executable != NULL) {
+    file_close(executable);
+  }
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -379,11 +378,6 @@ process_exit (void)
     }
 }
 
-static void unmap_elem(struct hash_elem *elem, void *aux UNUSED) {
-  struct mapid_to_addr *mta = hash_entry(elem, struct mapid_to_addr, hash_elem);
-  munmap(mta->mapid);
-}
-
 /* Sets up the CPU for running user code in the current
    thread.
    This function is called on every context switch. */
@@ -675,9 +669,8 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       if (page_zero_bytes == PGSIZE) {
         supp_page_table_insert(&t->supp_page_table, upage, ZEROED);
       } else {
-        supp_page_table_insert(&t->supp_page_table, upage, MMAPPED);
-        mmap_file_page_table_insert(&t->mmap_file_page_table, upage, 0, file,
-            file_page_offset, page_read_bytes, writable);
+        supp_page_table_insert_file(&t->supp_page_table, upage, EXECUTABLE,
+            file, file_page_offset, page_read_bytes, writable);
       }
 
       /* Advance. */
@@ -697,23 +690,21 @@ setup_stack (void **esp)
   uint8_t *kpage;
   bool success = false;
 
-  enum intr_level old_level = intr_disable();
-
   struct thread *t = thread_current();
 
   uint8_t *page_addr = ((uint8_t *) PHYS_BASE) - PGSIZE;
   kpage = (uint8_t *) frame_get_page(page_addr);
   if (kpage != NULL) {
       success = install_page(page_addr, kpage, true);
-      supp_page_table_insert(&t->supp_page_table, page_addr, LOADED);
-      if (success)
+      if (success) {
+        supp_page_table_insert(&t->supp_page_table, page_addr, LOADED);
+        frame_unpin (kpage);
         *esp = PHYS_BASE;
-      else
+      } else {
         frame_free_page (kpage);
+      }
   }
 
-  intr_set_level(old_level);
-
   return success;
 }
 
@@ -26,9 +26,6 @@ static void syscall_handler (struct intr_frame *);
 /* Function to get the nth argument of the system call. */
 static void* get_arg(struct intr_frame *, int n);
 
-/* Ensures that only one syscall can touch the file system at a time. */
-static struct lock filesys_lock;
-
 /* System call function declarations. */
 static void sys_halt(struct intr_frame *);
 static void sys_exit(struct intr_frame *);
@@ -52,6 +49,7 @@ static void check_pointer(const void *ptr);
 static void check_pointer_range(const void *ptr, unsigned size);
 static void check_safe_string(const char *str);
 static bool check_any_mapped(void *start, void *stop);
+static void unmap_page(struct supp_page *page, void *spt_);
 
 
 /* Contiguous number of system calls implemented, starting from 0 (HALT). */
@@ -68,7 +66,6 @@ void
 syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&filesys_lock);
 }
 
 static void
@@ -115,9 +112,7 @@ static void sys_exec (struct intr_frame * f)
 {
   const char* cmd_line = (const char*) get_arg(f, 1);
   check_safe_string(cmd_line);
-  lock_filesys_access();
   f->eax = process_execute(cmd_line);
-  unlock_filesys_access();
 }
 
 static void sys_wait (struct intr_frame * f)
@@ -132,9 +127,7 @@ static void sys_create (struct intr_frame * f)
   check_safe_string(file);
   unsigned initial_size = (unsigned) get_arg(f, 2);
 
-  lock_filesys_access();
   bool success = filesys_create(file, initial_size);
-  unlock_filesys_access();
 
   f->eax = success;
 }
@@ -144,9 +137,7 @@ static void sys_remove(struct intr_frame * f)
   const char* file = (const char*) get_arg(f, 1);
   check_safe_string(file);
 
-  lock_filesys_access();
   bool success = filesys_remove(file);
-  unlock_filesys_access();
 
   f->eax = success;
 }
@@ -165,7 +156,6 @@ static void sys_open(struct intr_frame * f)
     goto exit;
   }
 
-  lock_filesys_access();
   struct file* file = filesys_open(name);
 
   /* Store the file in the descriptor and map it to the next_fd value.
@@ -178,8 +168,6 @@ static void sys_open(struct intr_frame * f)
     list_push_back(&t->descriptors, &d->elem);
   }
 
-  unlock_filesys_access();
-
 exit:
   f->eax = fd;
 }
@@ -189,7 +177,6 @@ static void sys_filesize(struct intr_frame * f)
   int fd = (int) get_arg(f, 1);
   /* File size. This is -1 if the file couldn't be opened. */
   int file_byte_size = -1;
-  lock_filesys_access();
 
   /* Go through the list and see if this file descriptor exists. */
   struct file *file = find_file(fd);
@@ -197,7 +184,6 @@ static void sys_filesize(struct intr_frame * f)
     file_byte_size = file_length(file);
   }
 
-  unlock_filesys_access();
   f->eax = file_byte_size;
 }
 
@@ -230,12 +216,10 @@ static void sys_read(struct intr_frame * f)
       barrier();
     }
     /* Otherwise we're reading from a file instead. */
-    lock_filesys_access();
     struct file *file = find_file(fd);
     if (file != NULL) {
       bytes_read = file_read(file, buffer, size);
     }
-    unlock_filesys_access();
   }
   f->eax = bytes_read;
 }
@@ -266,14 +250,10 @@ static void sys_write(struct intr_frame * f)
     }
 
     /* Otherwise we're writing to a file instead. */
-    lock_filesys_access();
-
     struct file *file = find_file(fd);
     if (file != NULL) {
       bytes_written = file_write(file, buffer, size);
     }
-
-    unlock_filesys_access();
   }
   f->eax = bytes_written;
 }
@@ -282,14 +262,11 @@ static void sys_seek(struct intr_frame * f)
 {
   int fd = (int) get_arg(f, 1);
   unsigned position = (unsigned) get_arg(f, 2);
-  lock_filesys_access();
 
   /* If the file descriptor exists, seek to the right position. */
   struct file *file = find_file(fd);
   if (file != NULL)
     file_seek(file, position);
-
-  unlock_filesys_access();
 }
 
 static void sys_tell(struct intr_frame * f)
@@ -297,13 +274,10 @@ static void sys_tell(struct intr_frame * f)
   int fd = (int) get_arg(f, 1);
   unsigned position = 0;
 
-  lock_filesys_access();
-
   struct file *file = find_file(fd);
   if (file != NULL)
     position = file_tell(file);
 
-  unlock_filesys_access();
   f->eax = position;
 }
 
@@ -311,8 +285,6 @@ static void sys_close(struct intr_frame * f)
 {
   int fd = (int) get_arg(f, 1);
 
-  lock_filesys_access();
-
   struct list_elem *e;
   for (e = list_begin (&thread_current()->descriptors);
        e != list_end (&thread_current()->descriptors);
@@ -330,9 +302,6 @@ static void sys_close(struct intr_frame * f)
     }
 
   }
-
-  unlock_filesys_access();
-
 }
 
 static void sys_mmap(struct intr_frame * f)
@@ -349,9 +318,7 @@ static void sys_mmap(struct intr_frame * f)
     goto ret;
   }
 
-  lock_filesys_access();
   uint32_t read_bytes = file_length(file);
-  unlock_filesys_access();
 
   if (read_bytes == 0 || check_any_mapped(addr, addr + read_bytes)) {
     goto ret;
@@ -362,19 +329,18 @@ static void sys_mmap(struct intr_frame * f)
   uint32_t zero_bytes = PGSIZE - read_bytes % PGSIZE;
   /* Make an spt entry for each page */
 
-  lock_filesys_access();
   file = file_reopen(file);
-  unlock_filesys_access();
   uint32_t curr_page;
   for (curr_page = 0;
-       curr_page <= read_bytes;
+       curr_page < read_bytes;
        curr_page += PGSIZE)
   {
-    mmap_file_page_table_insert(&t->mmap_file_page_table, addr + curr_page,
-        mapid, file, curr_page, PGSIZE, true);
-    supp_page_table_insert(&t->supp_page_table, addr + curr_page, MMAPPED);
+    uint32_t page_read_bytes = read_bytes - curr_page < PGSIZE
+        ? read_bytes - curr_page : PGSIZE;
+    supp_page_table_insert_file(&t->supp_page_table, addr + curr_page,
+        MMAPPED, file, curr_page, page_read_bytes, true);
   }
-  add_mapping(&t->mapid_page_table, mapid, addr, addr + curr_page);
+  add_mapping(&t->mapid_page_table, mapid, addr, addr + curr_page, file);
 ret:
   f->eax = mapid;
 }
@@ -389,25 +355,18 @@ void munmap(mapid_t mapping) {
   struct thread* t = thread_current();
   struct mapid_to_addr* mapped_addrs = get_mapping(&t->mapid_page_table,
       mapping);
-  struct file *file = NULL;
-  for (void* curr = mapped_addrs->start_addr;
-       curr < mapped_addrs->end_addr;
-       curr += PGSIZE) {
-    struct mmap_file_page* page
-      = mmap_file_page_table_get(&t->mmap_file_page_table, curr);
-    file = page->file;
-    void* kaddr = pagedir_get_page(t->pagedir, curr);
-    if (kaddr != NULL) {
-      clear_frame(kaddr);
-      pagedir_clear_page(t->pagedir, curr);
-    }
-    mmap_file_page_table_delete_entry(&t->mmap_file_page_table, page);
-    supp_page_table_remove(&t->supp_page_table, curr);
-  }
+  struct file *file = mapped_addrs->file;
+  supp_page_table_walk(&t->supp_page_table, mapped_addrs->start_addr,
+      mapped_addrs->end_addr, &unmap_page, &t->supp_page_table);
   delete_mapping(&t->mapid_page_table, mapping);
-  lock_filesys_access();
   file_close(file);
-  unlock_filesys_access();
+}
+
+/* Write back and remove a page of a mapping from spt_. */
+static void unmap_page(struct supp_page *page, void *spt_) {
+  struct supp_page_table *spt = spt_;
+  frame_release_page(page->vaddr, true);
+  supp_page_table_remove(spt, page->vaddr);
 }
 
 /******************************
@@ -427,20 +386,6 @@ struct file *find_file (int fd)
   return NULL;
 }
 
-void lock_filesys_access(void)
-{
-  if (!lock_held_by_current_thread(&filesys_lock)) {
-    lock_acquire(&filesys_lock);
-  }
-}
-
-void unlock_filesys_access(void)
-{
-  if (lock_held_by_current_thread(&filesys_lock)) {
-    lock_release(&filesys_lock);
-  }
-}
-
 static void check_pointer(const void *ptr)
 {
   check_safe_access(ptr, 1);
@@ -1,31 +1,111 @@
 #include "vm/frame.h"
+#include <stdio.h>
+#include <string.h>
 #include "vm/page.h"
 #include "threads/vaddr.h"
 #include "vm/swap.h"
-#include "vm/mmap.h"
 #include "filesys/file.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "userprog/pagedir.h"
-#include "userprog/syscall.h"
+#include "userprog/process.h"
 
 static unsigned frame_hash_func(const struct hash_elem *e, void *aux);
 static bool frame_hash_less(const struct hash_elem *e1,
      const struct hash_elem *e2, void *aux);
+static unsigned share_hash_func(const struct hash_elem *e, void *aux);
+static bool share_hash_less(const struct hash_elem *e1,
+     const struct hash_elem *e2, void *aux);
 static void frame_access_lock(void);
 static void frame_access_unlock(void);
+static void frame_insert(void *kpage, void *upage, bool readahead);
+static struct frame * frame_lookup(void *kaddr);
+static void frame_remove(struct frame *f);
+static void frame_unshare(struct frame *f);
+static void frame_destroy(struct frame *f);
+static struct frame_mapping * frame_add_mapping(struct frame *f, void *upage);
+static struct frame_mapping * frame_owner(struct frame *f);
+static bool frame_is_dirty(struct frame *f);
+static bool frame_test_and_clear_accessed(struct frame *f);
 static struct frame * choose_victim(void);
-static void frame_evict(struct frame *victim);
+static struct frame * clock_advance(void);
+static bool frame_needs_writeback(struct frame *f);
+static void frame_settle_readahead(struct frame *f);
+static void * frame_evict(void);
+static void frame_write_out(struct frame *victim);
+static void frame_cleaner(void *aux);
+static void frame_clean(size_t batch);
+static void frame_clean_page(struct frame *f);
+static void * frame_reserve_take(void);
+static void frame_reserve_fill(void);
+static void frame_cleaner_wake(void);
 
 static struct hash frame_table;
 static struct lock frame_lock;
 
+/* Frames holding read-only pages of executables, keyed by inode and offset,
+   so that every process running the same program maps the same frame. */
+static struct hash share_table;
+
+/* Every frame in the frame table is also on the clock, a circular list that
+   the hand sweeps round when looking for a victim. */
+static struct list frame_clock;
+static struct list_elem *clock_hand;
+
+/* Threads that fault on a page while it is being written out of its frame
+   wait on evict_done until the eviction has finished. */
+static struct lock evict_lock;
+static struct condition evict_done;
+
+/* The page cleaner pins a frame while it writes the frame out without
+   unmapping it.  A process giving up the page waits on frame_unpinned, with
+   the frame lock, until the cleaner is done. */
+static struct condition frame_unpinned;
+
+/* The page cleaner is woken when a frame is handed out while fewer user pages
+   than the user pool's low watermark are free.  It writes out up to
+   CLEANER_BATCH dirty frames that the clock hand is about to reach, so that
+   they can be evicted without waiting for a write, then evicts frames into
+   the reserve. */
+#define CLEANER_BATCH 8
+static struct semaphore cleaner_wake;
+static bool cleaner_woken;          /* Cleaner has been woken and not slept */
+
+/* The reserve is a stack of pages taken from evicted frames and zeroed in
+   advance by the cleaner, for frame_get_page() to hand out when palloc has
+   none, without having to evict anything.  The cleaner keeps it full while
+   free pages are below the high watermark.  Protected by the frame lock. */
+#define FRAME_RESERVE_SIZE 8
+static void *frame_reserve[FRAME_RESERVE_SIZE];
+static size_t frame_reserve_cnt;
+
+/* Eviction statistics. */
+static long long evict_cnt;         /* Frames evicted */
+static long long hand_move_cnt;     /* Frames the clock hand has passed */
+static long long writeback_cnt;     /* Evictions that had to write the page */
+static long long share_cnt;         /* Faults satisfied by a shared frame */
+static long long clean_cnt;         /* Frames written out by the cleaner */
+static long long reserve_cnt;       /* Frames handed out from the reserve */
+
 void frame_init (void)
 {
     lock_init(&frame_lock);
     hash_init(&frame_table, &frame_hash_func, &frame_hash_less, NULL);
+    hash_init(&share_table, &share_hash_func, &share_hash_less, NULL);
+    list_init(&frame_clock);
+    clock_hand = NULL;
+    lock_init(&evict_lock);
+    cond_init(&evict_done);
+    cond_init(&frame_unpinned);
+    sema_init(&cleaner_wake, 0);
+}
+
+/* Start the page cleaner.  Must be called once swap is available. */
+void frame_cleaner_init (void)
+{
+    thread_create("page-cleaner", PRI_DEFAULT, frame_cleaner, NULL);
 }
 
 static void frame_access_lock()
@@ -38,136 +118,659 @@ static void frame_access_unlock()
     lock_release(&frame_lock);
 }
 
-/* Get a frame of memory for the current thread */
+/* Get a frame of memory for the current thread.  The frame is returned
+   pinned, so that it cannot be evicted before the caller has filled it and
+   mapped it in; the caller must then release it with frame_unpin(). */
 void* frame_get_page(void *upage)
 {
     ASSERT(is_user_vaddr(upage));
     void *kpage = palloc_get_page(PAL_USER | PAL_ZERO);
 
-    frame_access_lock();
-
     if (kpage == NULL) {
-      /* make space and try again */
-      frame_evict(choose_victim());
-      kpage = palloc_get_page(PAL_USER | PAL_ZERO);
-      ASSERT(kpage != NULL);
+      kpage = frame_reserve_take();
+    }
+    if (kpage == NULL) {
+      /* make space, reusing the victim's page for the new frame */
+      kpage = frame_evict();
+      if (kpage == NULL) {
+        PANIC("Every frame is pinned, nothing can be evicted");
+      }
+      memset(kpage, 0, PGSIZE);
+    }
+    frame_insert(kpage, upage, false);
+
+    if (palloc_free_cnt(PAL_USER) < palloc_low_water(PAL_USER)) {
+      frame_cleaner_wake();
+    }
+    return kpage;
+
+}
+
+/* As frame_get_page(), but for a page being read ahead of any access to it.
+   Never evicts anything to make room: returns null instead if there is no
+   free memory. */
+void* frame_get_readahead_page(void *upage)
+{
+    ASSERT(is_user_vaddr(upage));
+    void *kpage = palloc_get_page(PAL_USER);
+
+    if (kpage != NULL) {
+      frame_insert(kpage, upage, true);
     }
+    return kpage;
+}
+
+/* Add a new pinned frame table entry for upage of the current thread, held in
+   kpage. */
+static void frame_insert(void *kpage, void *upage, bool readahead)
+{
     struct frame *new_frame = (struct frame *) malloc(sizeof(struct frame));
 
     if (new_frame == NULL) {
         PANIC("Cannot malloc");
     }
 
-    new_frame->t = thread_current();
+    list_init(&new_frame->mappings);
+    frame_add_mapping(new_frame, upage);
     new_frame->kaddr = kpage;
-    new_frame->uaddr = upage;
+    new_frame->pinned = true;
+    new_frame->readahead = readahead;
+    new_frame->inode = NULL;
 
+    frame_access_lock();
 
     struct hash_elem *success = hash_insert(&frame_table, &new_frame->hash_elem);
-    frame_access_unlock();
-
     if (success != NULL) {
       PANIC("Trying to insert pre-existing frame to the frame table");
     }
 
-    return kpage;
+    /* New frames go just behind the hand, so they are the last to be
+       considered on the current sweep. */
+    if (clock_hand == NULL) {
+      list_push_back(&frame_clock, &new_frame->clock_elem);
+      clock_hand = &new_frame->clock_elem;
+    } else {
+      list_insert(clock_hand, &new_frame->clock_elem);
+    }
+    frame_access_unlock();
+}
+
+/* If some process already has page ofs of the executable inode in a frame,
+   share it with the current thread's page uaddr, mapping it in read-only, and
+   return true.  Otherwise returns false.  The page is mapped in before the
+   frame lock is released, since the frame may be evicted as soon as it is,
+   and eviction expects every mapping it finds to be installed. */
+bool frame_share_get(void *uaddr, struct inode *inode, off_t ofs)
+{
+    struct frame target;
+    target.inode = inode;
+    target.ofs = ofs;
+    bool shared = false;
+
+    ASSERT(is_user_vaddr(uaddr));
+    frame_access_lock();
+    struct hash_elem *e = hash_find(&share_table, &target.share_elem);
+    if (e != NULL) {
+      struct frame *f = hash_entry(e, struct frame, share_elem);
+      if (install_page(uaddr, f->kaddr, false)) {
+        frame_add_mapping(f, uaddr);
+        share_cnt++;
+        shared = true;
+      }
+    }
+    frame_access_unlock();
+    return shared;
+}
+
+/* Offer the frame at kaddr, which the caller has just filled with page ofs of
+   the executable inode, for other processes to share.  If another frame has
+   been offered for the same page in the meantime, that one is kept. */
+void frame_share_publish(void *kaddr, struct inode *inode, off_t ofs)
+{
+    frame_access_lock();
+    struct frame *f = frame_lookup(kaddr);
+    ASSERT(f != NULL && f->inode == NULL);
+    f->inode = inode;
+    f->ofs = ofs;
+    if (hash_insert(&share_table, &f->share_elem) != NULL) {
+      f->inode = NULL;
+    }
+    frame_access_unlock();
+}
 
+/* Allow the frame at kaddr to be chosen for eviction again. */
+void frame_unpin(void *kaddr)
+{
+    frame_access_lock();
+    struct frame *f = frame_lookup(kaddr);
+    ASSERT(f != NULL && f->pinned);
+    f->pinned = false;
+    frame_access_unlock();
 }
 
-/* Remove a frame from the frame table, and give up the frame */
+/* Remove a pinned frame that was never mapped in from the frame table, and
+   give up the frame */
 void frame_free_page(void *kaddr)
 {
-    struct frame f;
-    f.kaddr = kaddr;
+    frame_access_lock();
+    struct frame *f = frame_lookup(kaddr);
+    ASSERT(f != NULL && f->pinned);
+    frame_remove(f);
+    frame_access_unlock();
+
+    palloc_free_page(f->kaddr);
+    frame_destroy(f);
+}
+
+/* Give up the frame holding the current thread's page upage, if it has one.
+   If write_back is true the page is first written back to its file, as if it
+   had been evicted.  If another thread is part way through evicting the page,
+   waits for it to finish. */
+void frame_release_page(void *upage, bool write_back)
+{
+    struct thread *t = thread_current();
+    struct frame *f;
+
+    frame_access_lock();
+    for (;;) {
+      void *kaddr = pagedir_get_page(t->pagedir, upage);
+      if (kaddr == NULL) {
+        /* Not in memory, or being written out by someone else. */
+        frame_access_unlock();
+        struct supp_page *spte = supp_page_table_get(&t->supp_page_table,
+            upage);
+        if (spte != NULL) {
+          frame_wait_eviction(spte);
+        }
+        return;
+      }
+
+      f = frame_lookup(kaddr);
+      ASSERT(f != NULL);
+      if (!f->pinned || list_size(&f->mappings) > 1) {
+        break;
+      }
+      /* The page cleaner is writing the page out.  Once it has finished the
+         page may have been evicted, so look it up again. */
+      cond_wait(&frame_unpinned, &frame_lock);
+    }
 
-    bool have_frame_lock = lock_held_by_current_thread(&frame_lock);
-    if (!have_frame_lock) {
-      frame_access_lock();
+    if (list_size(&f->mappings) > 1) {
+      /* Other processes still use the frame, so only our mapping goes. */
+      struct frame_mapping *m = NULL;
+      struct list_elem *e;
+      for (e = list_begin(&f->mappings); e != list_end(&f->mappings);
+           e = list_next(e)) {
+        m = list_entry(e, struct frame_mapping, elem);
+        if (m->t == t && m->uaddr == upage) {
+          break;
+        }
+      }
+      ASSERT(e != list_end(&f->mappings));
+      list_remove(&m->elem);
+      pagedir_clear_page(t->pagedir, upage);
+      frame_access_unlock();
+      free(m);
+      return;
     }
+    ASSERT(!f->pinned);
+    f->pinned = true;
+    frame_settle_readahead(f);
+    if (write_back) {
+      frame_write_out(f);
+    } else {
+      pagedir_clear_page(t->pagedir, upage);
+    }
+    frame_remove(f);
+    frame_access_unlock();
 
-    struct hash_elem *del_elem = hash_delete(&frame_table, &f.hash_elem);
+    palloc_free_page(f->kaddr);
+    frame_destroy(f);
+}
+
+/* Block until the page spte is no longer being evicted. */
+void frame_wait_eviction(struct supp_page *spte)
+{
+    lock_acquire(&evict_lock);
+    while (spte->status == EVICTING) {
+      cond_wait(&evict_done, &evict_lock);
+    }
+    lock_release(&evict_lock);
+}
+
+/* Returns the frame table entry for the page at kaddr, or null if there is
+   none.  Must be called with the frame lock held. */
+static struct frame * frame_lookup(void *kaddr)
+{
+    struct frame target;
+    target.kaddr = kaddr;
+    struct hash_elem *elem = hash_find(&frame_table, &target.hash_elem);
+    return elem == NULL ? NULL : hash_entry(elem, struct frame, hash_elem);
+}
+
+/* Take f out of the frame table and off the clock, moving the hand on if it
+   points at f.  Must be called with the frame lock held. */
+static void frame_remove(struct frame *f)
+{
+    struct hash_elem *del_elem = hash_delete(&frame_table, &f->hash_elem);
     ASSERT(del_elem != NULL);
-    struct frame *del_frame = hash_entry(del_elem, struct frame, hash_elem);
+    frame_unshare(f);
 
-    // Frees the page and removes its reference
-    pagedir_clear_page(del_frame->t->pagedir, del_frame->uaddr);
+    if (clock_hand == &f->clock_elem) {
+      clock_hand = list_next(clock_hand);
+      if (clock_hand == list_end(&frame_clock)) {
+        clock_hand = list_begin(&frame_clock);
+      }
+      if (clock_hand == &f->clock_elem) {
+        clock_hand = NULL;
+      }
+    }
+    list_remove(&f->clock_elem);
+}
 
-    palloc_free_page(del_frame->kaddr);
-    free(del_frame);
+/* Stop offering f to processes faulting on the page it holds.  Must be
+   called with the frame lock held. */
+static void frame_unshare(struct frame *f)
+{
+  if (f->inode != NULL) {
+    hash_delete(&share_table, &f->share_elem);
+    f->inode = NULL;
+  }
+}
 
-    if (!have_frame_lock) {
-      frame_access_unlock();
+/* Free the frame table entry f, which is no longer in the frame table, and
+   its list of mappings. */
+static void frame_destroy(struct frame *f)
+{
+  while (!list_empty(&f->mappings)) {
+    free(list_entry(list_pop_front(&f->mappings), struct frame_mapping, elem));
+  }
+  free(f);
+}
+
+/* Record that the current thread maps f at upage, and return the record. */
+static struct frame_mapping * frame_add_mapping(struct frame *f, void *upage)
+{
+  struct frame_mapping *m = malloc(sizeof(struct frame_mapping));
+  if (m == NULL) {
+    PANIC("Cannot malloc");
+  }
+  m->t = thread_current();
+  m->uaddr = upage;
+  list_push_back(&f->mappings, &m->elem);
+  return m;
+}
+
+/* Returns the first mapping of f.  Every process mapping a frame agrees on
+   what kind of page it holds, so this one can speak for all of them. */
+static struct frame_mapping * frame_owner(struct frame *f)
+{
+  ASSERT(!list_empty(&f->mappings));
+  return list_entry(list_front(&f->mappings), struct frame_mapping, elem);
+}
+
+/* Returns true if any process has written to f through its mapping. */
+static bool frame_is_dirty(struct frame *f)
+{
+  struct list_elem *e;
+  for (e = list_begin(&f->mappings); e != list_end(&f->mappings);
+       e = list_next(e)) {
+    struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+    if (pagedir_is_dirty(m->t->pagedir, m->uaddr)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Returns true if any process has accessed f through its mapping since the
+   last call, and clears the accessed bit in every mapping. */
+static bool frame_test_and_clear_accessed(struct frame *f)
+{
+  bool accessed = false;
+  struct list_elem *e;
+  for (e = list_begin(&f->mappings); e != list_end(&f->mappings);
+       e = list_next(e)) {
+    struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+    if (pagedir_is_accessed(m->t->pagedir, m->uaddr)) {
+      pagedir_set_accessed(m->t->pagedir, m->uaddr, false);
+      accessed = true;
     }
+  }
+  return accessed;
 }
 
-/* Choose a frame as a candidate for eviction. */
+/* Choose a frame as a candidate for eviction, using the clock (second chance)
+   algorithm.  Frames that any of their mappings has accessed have the accessed
+   bits cleared and are passed over, as are pinned frames.  Among the frames
+   that have not been accessed, one that can be dropped without writing it
+   anywhere is preferred; the first one that needs writing back is only used if
+   no clean frame turns up within two turns of the hand.  Returns null if
+   every frame is pinned.  Must be called with the frame lock held. */
 static struct frame * choose_victim(void)
 {
-  ASSERT(!hash_empty(&frame_table));
-
-  struct frame *victim = NULL;
-
-  /* Choose the first entry in the hash table, which is essentially random */
-  struct hash_iterator iter;
-  hash_first(&iter, &frame_table);
-  while (hash_next(&iter)) {
-    victim = hash_entry(hash_cur(&iter), struct frame, hash_elem);
-  }
-
-  /* make sure we found a victim */
-  ASSERT(victim != NULL);
-  return victim;
-}
-
-/* clear the given frame of memory */
-bool clear_frame(void *kaddr) {
-  ASSERT(is_kernel_vaddr(kaddr));
-  struct frame target;
-  target.kaddr = kaddr;
-  struct hash_elem *elem = hash_find(&frame_table, &target.hash_elem);
-  if (elem == NULL) {
-    return false;
-  }
-  struct frame *found = hash_entry(elem, struct frame, hash_elem);
-  frame_evict(found);
-  return true;
-}
-
-/* Evict a frame from memory, taking appropriate action to write it out to the
-   backing store (either swap or a file). Also frees it's frame table entry. */
-static void frame_evict(struct frame *victim)
-{
-  struct supp_page *spte = supp_page_table_get(&victim->t->supp_page_table,
-      victim->uaddr);
-  switch (spte->status) {
-    case LOADED:
-      /* normal memory, swap out to disk */
-      pagedir_clear_page(victim->t->pagedir, victim->uaddr);
-      swap_to_disk(&victim->t->swap_table, victim->uaddr, victim->kaddr);
-      spte->status = SWAPPED;
-      break;
-    case MMAPPED:
-      /* write the frame back to disk, if it has been modified */
-      if (pagedir_is_dirty(victim->t->pagedir, victim->uaddr)) {
-        pagedir_clear_page(victim->t->pagedir, victim->uaddr);
-        struct mmap_file_page *mmfp = mmap_file_page_table_get(
-            &victim->t->mmap_file_page_table, victim->uaddr);
-        lock_filesys_access();
-        file_seek(mmfp->file, mmfp->ofs);
-        file_write(mmfp->file, victim->kaddr, mmfp->size);
-        unlock_filesys_access();
+  if (list_empty(&frame_clock)) {
+    return NULL;
+  }
+
+  struct frame *dirty_victim = NULL;
+  size_t frame_cnt = hash_size(&frame_table);
+
+  /* After one full turn every accessed bit has been cleared, so a second
+     turn is guaranteed to find a candidate. */
+  for (size_t i = 0; i < 2 * frame_cnt; i++) {
+    struct frame *f = clock_advance();
+    if (f->pinned) {
+      continue;
+    }
+
+    frame_settle_readahead(f);
+    if (frame_test_and_clear_accessed(f)) {
+      continue;
+    }
+    if (!frame_needs_writeback(f)) {
+      return f;
+    }
+    if (dirty_victim == NULL) {
+      dirty_victim = f;
+    }
+  }
+
+  /* Pages may be touched again while we sweep, so fall back on the first
+     unpinned frame under the hand. */
+  for (size_t i = 0; dirty_victim == NULL && i < frame_cnt; i++) {
+    struct frame *f = clock_advance();
+    if (!f->pinned) {
+      dirty_victim = f;
+    }
+  }
+  return dirty_victim;
+}
+
+/* Moves the clock hand on by one frame and returns the frame it passed. */
+static struct frame * clock_advance(void)
+{
+  ASSERT(clock_hand != NULL);
+
+  struct frame *f = list_entry(clock_hand, struct frame, clock_elem);
+  clock_hand = list_next(clock_hand);
+  if (clock_hand == list_end(&frame_clock)) {
+    clock_hand = list_begin(&frame_clock);
+  }
+  hand_move_cnt++;
+  return f;
+}
+
+/* Returns true if evicting F means writing its contents out, either to swap
+   or back to a memory mapped file.  Clean file backed pages can just be read
+   in again, and clean pages the cleaner has copied to swap left there. */
+static bool frame_needs_writeback(struct frame *f)
+{
+  struct frame_mapping *owner = frame_owner(f);
+  struct supp_page *spte = supp_page_table_get(&owner->t->supp_page_table,
+      owner->uaddr);
+  ASSERT(spte != NULL);
+  return frame_is_dirty(f)
+      || (spte->status == LOADED && spte->swap_slot == BITMAP_ERROR);
+}
+
+/* If f was filled by swap read-ahead, report to the swap system whether the
+   page has been used since.  Must be called with the frame lock held, before
+   anything clears the accessed bit. */
+static void frame_settle_readahead(struct frame *f)
+{
+  if (f->readahead) {
+    struct frame_mapping *owner = frame_owner(f);
+    f->readahead = false;
+    swap_readahead_feedback(pagedir_is_accessed(owner->t->pagedir,
+        owner->uaddr));
+  }
+}
+
+/* Evict a frame from memory and return its now unused page, or null if there
+   is nothing that can be evicted.  The frame lock is only held while choosing
+   the victim, not while it is written out. */
+static void * frame_evict(void)
+{
+  frame_access_lock();
+  struct frame *victim = choose_victim();
+  if (victim == NULL) {
+    frame_access_unlock();
+    return NULL;
+  }
+  victim->pinned = true;
+  frame_write_out(victim);
+  frame_remove(victim);
+  frame_access_unlock();
+
+  void *kpage = victim->kaddr;
+  frame_destroy(victim);
+  return kpage;
+}
+
+/* Unmap the pinned frame victim from every process mapping it and write it
+   out to the backing store (either swap or a file), as appropriate.  Must be
+   called with the frame lock held; the lock is released while the page is
+   written and reacquired before returning.  Any process mapping the page
+   waits in frame_wait_eviction() if it faults on it in the meantime. */
+static void frame_write_out(struct frame *victim)
+{
+  struct frame_mapping *owner = frame_owner(victim);
+  struct supp_page *spte = supp_page_table_get(&owner->t->supp_page_table,
+      owner->uaddr);
+  enum page_status_t status = spte->status;
+  bool dirty = frame_is_dirty(victim);
+  swap_index_t slot = spte->swap_slot;
+  bool written = false;
+  struct list_elem *e;
+
+  ASSERT(victim->pinned);
+  frame_unshare(victim);
+  if (status != LOADED && status != MMAPPED && status != EXECUTABLE) {
+    /* These types of pages shouldn't be in a frame, panic the kernel */
+    PANIC("Bad type of page in memory!");
+  }
+
+  /* Unmap before writing, so that nobody faults rather than changing the
+     page under our feet. */
+  for (e = list_begin(&victim->mappings); e != list_end(&victim->mappings);
+       e = list_next(e)) {
+    struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+    supp_page_table_get(&m->t->supp_page_table, m->uaddr)->status = EVICTING;
+    pagedir_clear_page(m->t->pagedir, m->uaddr);
+  }
+  evict_cnt++;
+  frame_access_unlock();
+
+  if (slot != BITMAP_ERROR) {
+    /* the cleaner has already copied the page to swap, so it only needs
+       writing again if it has changed since. */
+    ASSERT(list_size(&victim->mappings) == 1);
+    if (dirty) {
+      swap_write(slot, victim->kaddr);
+      written = true;
+    }
+    status = SWAPPED;
+  } else if (status == LOADED || (status == EXECUTABLE && dirty)) {
+    /* normal memory, or a page of the executable that differs from the file
+       and so can't be reread from it: swap out to disk.  Only read-only
+       pages are shared, so there is just the one owner to give the slot. */
+    ASSERT(list_size(&victim->mappings) == 1);
+    slot = swap_to_disk(victim->kaddr);
+    status = SWAPPED;
+    written = true;
+  } else if (status == MMAPPED && dirty) {
+    /* write the frame back to disk, since it has been modified.  The
+       owner may be faulting on another page of the same file, so don't
+       touch the file's position. */
+    file_write_at(spte->file, victim->kaddr, spte->read_bytes, spte->ofs);
+    written = true;
+  }
+
+  /* Once the mappers are woken they may free their page tables, so every
+     entry is updated before any of them is. */
+  lock_acquire(&evict_lock);
+  for (e = list_begin(&victim->mappings); e != list_end(&victim->mappings);
+       e = list_next(e)) {
+    struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+    struct supp_page *mspte = supp_page_table_get(&m->t->supp_page_table,
+        m->uaddr);
+    mspte->status = status;
+    mspte->swap_slot = slot;
+  }
+  cond_broadcast(&evict_done, &evict_lock);
+  lock_release(&evict_lock);
+
+  frame_access_lock();
+  if (written) {
+    writeback_cnt++;
+  }
+}
+
+/* The page cleaner thread. */
+static void frame_cleaner(void *aux UNUSED)
+{
+  /* Nobody waits for what the cleaner writes. */
+  block_set_class(BLOCK_CLASS_BACKGROUND);
+  for (;;) {
+    sema_down(&cleaner_wake);
+    frame_clean(CLEANER_BATCH);
+    frame_reserve_fill();
+
+    frame_access_lock();
+    cleaner_woken = false;
+    frame_access_unlock();
+  }
+}
+
+/* Wake the page cleaner, unless it is already awake. */
+static void frame_cleaner_wake(void)
+{
+  frame_access_lock();
+  if (!cleaner_woken) {
+    cleaner_woken = true;
+    sema_up(&cleaner_wake);
+  }
+  frame_access_unlock();
+}
+
+/* Take a zeroed page from the reserve, or return null if it is empty. */
+static void * frame_reserve_take(void)
+{
+  void *kpage = NULL;
+  frame_access_lock();
+  if (frame_reserve_cnt > 0) {
+    kpage = frame_reserve[--frame_reserve_cnt];
+    reserve_cnt++;
+  }
+  frame_access_unlock();
+  return kpage;
+}
+
+/* Evict frames into the reserve until it is full, or until free pages and
+   reserved ones together reach the user pool's high watermark. */
+static void frame_reserve_fill(void)
+{
+  for (;;) {
+    frame_access_lock();
+    bool full = frame_reserve_cnt == FRAME_RESERVE_SIZE
+        || palloc_free_cnt(PAL_USER) + frame_reserve_cnt
+           >= palloc_high_water(PAL_USER);
+    frame_access_unlock();
+    if (full) {
+      return;
+    }
+
+    void *kpage = frame_evict();
+    if (kpage == NULL) {
+      return;
+    }
+    memset(kpage, 0, PGSIZE);
+
+    frame_access_lock();
+    if (frame_reserve_cnt < FRAME_RESERVE_SIZE) {
+      frame_reserve[frame_reserve_cnt++] = kpage;
+      kpage = NULL;
+    }
+    frame_access_unlock();
+    if (kpage != NULL) {
+      palloc_free_page(kpage);
+    }
+  }
+}
+
+/* Write out up to batch of the frames that the clock hand will come to next
+   and that would have to be written if they were evicted, leaving them
+   mapped.  Frames that have been accessed recently are left alone, since they
+   won't be evicted on this turn of the hand and are likely to be written
+   again. */
+static void frame_clean(size_t batch)
+{
+  frame_access_lock();
+  size_t frame_cnt = hash_size(&frame_table);
+  struct list_elem *e = clock_hand;
+
+  for (size_t i = 0; e != NULL && i < frame_cnt && batch > 0; i++) {
+    struct frame *f = list_entry(e, struct frame, clock_elem);
+    if (!f->pinned && list_size(&f->mappings) == 1 && !f->readahead) {
+      struct frame_mapping *owner = frame_owner(f);
+      if (!pagedir_is_accessed(owner->t->pagedir, owner->uaddr)
+          && frame_needs_writeback(f)) {
+        /* f stays on the clock while it is pinned, so we can carry on from
+           it afterwards. */
+        f->pinned = true;
+        frame_clean_page(f);
+        f->pinned = false;
+        cond_broadcast(&frame_unpinned, &frame_lock);
+        batch--;
       }
-      break;
-    case SWAPPED:
-    case ZEROED:
-    default:
-      /* These types of pages shouldn't be in a frame, panic the kernel */
-      PANIC("Bad type of page in memory!");
-      NOT_REACHED();
+    }
+
+    e = list_next(&f->clock_elem);
+    if (e == list_end(&frame_clock)) {
+      e = list_begin(&frame_clock);
+    }
   }
+  frame_access_unlock();
+}
+
+/* Write the pinned frame f out to where it would go if it were evicted, but
+   leave it mapped.  Its dirty bit is cleared first, so that the page is
+   written again if it is changed while we write.  Must be called with the
+   frame lock held; it is released while the page is written. */
+static void frame_clean_page(struct frame *f)
+{
+  struct frame_mapping *owner = frame_owner(f);
+  struct supp_page *spte = supp_page_table_get(&owner->t->supp_page_table,
+      owner->uaddr);
+  enum page_status_t status = spte->status;
+  swap_index_t slot = spte->swap_slot;
+
+  ASSERT(f->pinned);
+  pagedir_set_dirty(owner->t->pagedir, owner->uaddr, false);
+  frame_access_unlock();
 
-  /* remove and free the frame table entry */
-  frame_free_page(victim->kaddr);
+  if (status == MMAPPED) {
+    file_write_at(spte->file, f->kaddr, spte->read_bytes, spte->ofs);
+  } else if (slot == BITMAP_ERROR) {
+    slot = swap_to_disk(f->kaddr);
+  } else {
+    swap_write(slot, f->kaddr);
+  }
+
+  frame_access_lock();
+  spte->swap_slot = slot;
+  clean_cnt++;
+}
+
+/* Prints frame table statistics. */
+void frame_print_stats(void)
+{
+  printf("Frames: %lld evictions, %lld clock hand moves, "
+         "%lld dirty write-backs, %lld shared page faults, "
+         "%lld pages cleaned, %lld reserve frames used\n",
+         evict_cnt, hand_move_cnt, writeback_cnt, share_cnt, clean_cnt,
+         reserve_cnt);
 }
 
 static unsigned frame_hash_func(const struct hash_elem *e_, void *aux UNUSED)
@@ -183,3 +786,20 @@ static bool frame_hash_less(const struct hash_elem *e1_,
     struct frame *e2 = hash_entry(e2_, struct frame, hash_elem);
     return e1->kaddr < e2->kaddr;
 }
+
+static unsigned share_hash_func(const struct hash_elem *e_, void *aux UNUSED)
+{
+    struct frame *e = hash_entry(e_, struct frame, share_elem);
+    return hash_bytes(&e->inode, sizeof(e->inode)) ^ hash_int(e->ofs);
+}
+
+static bool share_hash_less(const struct hash_elem *e1_,
+    const struct hash_elem *e2_, void *aux UNUSED)
+{
+    struct frame *e1 = hash_entry(e1_, struct frame, share_elem);
+    struct frame *e2 = hash_entry(e2_, struct frame, share_elem);
+    if (e1->inode != e2->inode) {
+      return e1->inode < e2->inode;
+    }
+    return e1->ofs < e2->ofs;
+}
@@ -2,21 +2,49 @@
 #define VM_FRAME_H
 
 #include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
 #include "vm/page.h"
 
+/* A user page that a frame is mapped at.  Each frame keeps a list of these,
+   so that everything mapping it can be found from the frame. */
+struct frame_mapping {
+    struct thread *t;           /* The process mapping the frame, whose page
+                                   directory and supplementary page table
+                                   describe the page */
+    void *uaddr;                /* The address in user memory. */
+    struct list_elem elem;      /* Element in the frame's mappings */
+};
+
 struct frame {
 
-    struct thread *t;           /* Reference to the process it belongs to */
-    void *uaddr;                /* The address in user memory. */
+    struct list mappings;       /* Every user page mapping this frame */
     void *kaddr;                /* Reference to page address in kernel vm.
                                    Also the key used for the hash table. */
+    bool pinned;                /* Pinned frames are never evicted; set while
+                                   a frame is being filled or written out */
+    bool readahead;             /* Filled by swap read-ahead and not yet seen
+                                   by the clock */
+    struct inode *inode;        /* For a read-only page of an executable that
+                                   can be shared, the executable's inode, */
+    off_t ofs;                  /* ...and the page's offset in it */
+    struct hash_elem share_elem;/* Element in the table of shared frames */
     struct hash_elem hash_elem; /* Hash table element */
+    struct list_elem clock_elem;/* Position on the clock used to choose
+                                   eviction victims */
 
 };
 
 void frame_init (void);
+void frame_cleaner_init (void);
 void* frame_get_page(void *uaddr);
+void* frame_get_readahead_page(void *uaddr);
+bool frame_share_get(void *uaddr, struct inode *inode, off_t ofs);
+void frame_share_publish(void *kaddr, struct inode *inode, off_t ofs);
+void frame_unpin(void *kaddr);
 void frame_free_page(void *kaddr);
-bool clear_frame(void *kaddr);
+void frame_release_page(void *upage, bool write_back);
+void frame_wait_eviction(struct supp_page *spte);
+void frame_print_stats(void);
 
 #endif /* vm/frame.h */
@@ -13,11 +13,7 @@ static unsigned mapaddr_hash_func(const struct hash_elem *elem,
     void *aux UNUSED);
 static bool mapaddr_less_func(const struct hash_elem *a,
     const struct hash_elem *b, void *aux UNUSED);
-
-static unsigned mfpt_hash_func(const struct hash_elem *elem, void *aux UNUSED);
-static bool mfpt_less_func(const struct hash_elem *a, const struct hash_elem *b,
-    void *aux UNUSED);
-static void delete_mfpt(struct hash_elem *elem, void *aux UNUSED);
+static void close_mapping(struct hash_elem *elem, void *aux UNUSED);
 
 /* Function definitons */
 
@@ -26,7 +22,7 @@ bool mapping_init(struct hash* table) {
 }
 
 bool add_mapping(struct hash* table, mapid_t mapid, void* start_addr,
-    void* end_addr) {
+    void* end_addr, struct file* file) {
   struct mapid_to_addr* map = malloc(sizeof(struct mapid_to_addr));
   if (map == NULL) {
     return false;
@@ -34,6 +30,7 @@ bool add_mapping(struct hash* table, mapid_t mapid, void* start_addr,
   map->mapid = mapid;
   map->start_addr = start_addr;
   map->end_addr = end_addr;
+  map->file = file;
   struct hash_elem* prev = hash_insert(table, &map->hash_elem);
   return prev == NULL;
 }
@@ -49,9 +46,24 @@ struct mapid_to_addr* get_mapping(struct hash* table, mapid_t mapid) {
 bool delete_mapping(struct hash* table, mapid_t mapid) {
   struct mapid_to_addr* entry = get_mapping(table, mapid);
   struct hash_elem* found = hash_delete(table, &entry->hash_elem);
+  if (found != NULL) {
+    free(entry);
+  }
   return found != NULL;
 }
 
+/* Close the files of all the mappings in table and free them.  Their pages
+   must already have been written back and removed. */
+void mapping_destroy(struct hash* table) {
+  hash_destroy(table, &close_mapping);
+}
+
+static void close_mapping(struct hash_elem *elem, void *aux UNUSED) {
+  struct mapid_to_addr* map = hash_entry(elem, struct mapid_to_addr, hash_elem);
+  file_close(map->file);
+  free(map);
+}
+
 static unsigned mapaddr_hash_func(const struct hash_elem *elem,
     void *aux UNUSED) {
   struct mapid_to_addr* e = hash_entry(elem, struct mapid_to_addr, hash_elem);
@@ -66,90 +78,6 @@ static bool mapaddr_less_func(const struct hash_elem *a,
 }
 
 
-
-bool mmap_file_page_table_init(struct hash* mmap_file_table) {
-  return hash_init(mmap_file_table, &mfpt_hash_func, &mfpt_less_func, NULL);
-}
-
-struct mmap_file_page * mmap_file_page_table_get(struct hash* table,
-    void *vaddr) {
-  struct mmap_file_page entry;
-  entry.vaddr = vaddr;
-  struct hash_elem *found = hash_find(table, &entry.hash_elem);
-  return found != NULL ? hash_entry(found, struct mmap_file_page,
-      hash_elem) : NULL;
-}
-
-bool mmap_file_page_table_insert(struct hash* table, void* vaddr, mapid_t mapid,
-    struct file* file, off_t ofs, uint32_t size, bool writable) {
-  struct mmap_file_page* mmap_page = malloc(sizeof(struct mmap_file_page));
-  if (mmap_page == NULL) {
-    return false;
-  }
-  ASSERT(size <= PGSIZE);
-  mmap_page->vaddr = vaddr;
-  mmap_page->mapid = mapid;
-  mmap_page->file = file;
-  mmap_page->ofs = ofs;
-  mmap_page->size = size;
-  mmap_page->writable = writable;
-  struct hash_elem *prev = hash_insert(table, &mmap_page->hash_elem);
-  // printf("AFTER INSERTION\n");
-  // print_mmap_table(table);
-  return prev == NULL;
-}
-
-bool mmap_file_page_table_delete_entry(struct hash* table,
-    struct mmap_file_page* entry) {
-  ASSERT(entry != NULL);
-  struct hash_elem* found = hash_delete(table, &entry->hash_elem);
-  if (found != NULL) {
-    delete_mfpt(found, NULL);
-  }
-  return found != NULL;
-}
-
-void mmap_file_page_table_destroy(struct hash *table)
-{
-  ASSERT(table != NULL);
-  hash_destroy(table, NULL/*&delete_mfpt*/);
-}
-
-static void delete_mfpt(struct hash_elem *elem, void *aux UNUSED)
-{
-  free(hash_entry(elem, struct mmap_file_page, hash_elem));
-}
-
-static unsigned mfpt_hash_func(const struct hash_elem *elem, void *aux UNUSED)
-{
-  struct mmap_file_page* e = hash_entry(elem, struct mmap_file_page, hash_elem);
-  return hash_bytes(&e->vaddr, sizeof(e->vaddr));
-}
-
-static bool mfpt_less_func(const struct hash_elem *a, const struct hash_elem *b,
-                   void *aux UNUSED)
-{
-  struct mmap_file_page* _a = hash_entry(a, struct mmap_file_page, hash_elem);
-  struct mmap_file_page* _b = hash_entry(b, struct mmap_file_page, hash_elem);
-  return _a->vaddr < _b->vaddr;
-}
-
-static void print_mmap_entry(struct hash_elem *elem, void *aux UNUSED);
-
-/* print an spt, one line per entry */
-void print_mmap_table(struct hash *table)
-{
-  hash_apply(table, print_mmap_entry);
-}
-
-static void print_mmap_entry(struct hash_elem *elem, void *aux UNUSED)
-{
-  struct mmap_file_page* p = hash_entry(elem, struct mmap_file_page, hash_elem);
-  char* is_writable = p->writable ? "True" : "False";
-  printf("MAPID: %d, VADDR: %p, FILE OFFSET: %d, SIZE: %d, WRITEABLE? %s\n",
-            p->mapid, p->vaddr, p->ofs, p->size, is_writable);
-}
-
 static void print_mapped_entry(struct hash_elem *elem, void *aux UNUSED);
 
 /* print an spt, one line per entry */
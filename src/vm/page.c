@@ -3,113 +3,192 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 
-static unsigned supp_pte_hash_func(const struct hash_elem *elem,
-    void *aux UNUSED);
-static bool supp_pte_less_func(const struct hash_elem *a,
-    const struct hash_elem *b, void *aux UNUSED);
-static void delete_supp_pte(struct hash_elem *elem, void *aux UNUSED);
-static void free_pte_related_resources(struct hash_elem *elem, void *pd_);
+/* Number of directory slots covering user virtual memory. */
+#define SPT_DIR_SIZE (pd_no(PHYS_BASE))
+/* Number of slots in each page table. */
+#define SPT_TABLE_SIZE (1 << PTBITS)
 
-/* Initialises a supplementary page table, and returns whether it was successful
-   in doing so */
-bool supp_page_table_init(struct hash *table)
+static struct supp_page ** lookup_slot(struct supp_page_table *spt,
+    const void *vaddr, bool create);
+static void free_pte_related_resources(struct supp_page *entry, void *aux);
+static struct supp_page * supp_page_table_add(struct supp_page_table *spt,
+    void *vaddr, enum page_status_t status);
+
+/* Initialises an empty supplementary page table.  No memory is allocated
+   until the first page is inserted. */
+void supp_page_table_init(struct supp_page_table *spt)
 {
-  return hash_init(table, supp_pte_hash_func, supp_pte_less_func, NULL);
+  spt->dir = NULL;
 }
 
 /* Destroy all of the elements of a supplementary page table.
    Takes appropriate action to deallocate resources for each entry. */
-void supp_page_table_destroy(struct hash *table)
+void supp_page_table_destroy(struct supp_page_table *spt)
 {
-  ASSERT(table != NULL);
-  hash_apply(table, &free_pte_related_resources);
-  hash_destroy(table, &delete_supp_pte);
+  ASSERT(spt != NULL);
+  if (spt->dir == NULL) {
+    return;
+  }
+
+  supp_page_table_walk(spt, 0, PHYS_BASE, &free_pte_related_resources, NULL);
+  for (size_t pde = 0; pde < SPT_DIR_SIZE; pde++) {
+    struct supp_page **table = spt->dir[pde];
+    if (table == NULL) {
+      continue;
+    }
+    for (size_t pte = 0; pte < SPT_TABLE_SIZE; pte++) {
+      free(table[pte]);
+    }
+    palloc_free_page(table);
+  }
+  palloc_free_page(spt->dir);
+  spt->dir = NULL;
 }
 
 /* Take appropriate action for a supplemntary page table entry when a process
-   exits.*/
-static void free_pte_related_resources(struct hash_elem *elem, void *aux UNUSED)
+   exits: give up the page's frame if it is in memory, waiting for any
+   eviction of it to finish first and writing back memory mapped pages, then
+   give up its swap slot if it has one. */
+static void free_pte_related_resources(struct supp_page *entry,
+    void *aux UNUSED)
+{
+  frame_release_page(entry->vaddr, entry->status == MMAPPED);
+  if (entry->swap_slot != BITMAP_ERROR) {
+    swap_free(entry->swap_slot);
+  }
+}
+
+/* Returns the slot for the page vaddr in spt.  If the page table it lives in
+   does not exist, creates it if create is true, or returns null otherwise. */
+static struct supp_page ** lookup_slot(struct supp_page_table *spt,
+    const void *vaddr, bool create)
 {
-  struct supp_page *entry
-      = hash_entry(elem, struct supp_page, hash_elem);
-  switch (entry->status) {
-    case LOADED:;
-      void *kaddr = pagedir_get_page(thread_current()->pagedir, entry->vaddr);
-      ASSERT(kaddr != NULL);
-      frame_free_page(kaddr);
-      break;
-
-    default:
-      break;
+  ASSERT(is_user_vaddr(vaddr));
+
+  if (spt->dir == NULL) {
+    if (!create) {
+      return NULL;
+    }
+    spt->dir = palloc_get_page(PAL_ZERO);
+    if (spt->dir == NULL) {
+      PANIC("Cannot allocate supplementary page directory");
+    }
+  }
+
+  struct supp_page ***pde = &spt->dir[pd_no(vaddr)];
+  if (*pde == NULL) {
+    if (!create) {
+      return NULL;
+    }
+    *pde = palloc_get_page(PAL_ZERO);
+    if (*pde == NULL) {
+      PANIC("Cannot allocate supplementary page table");
+    }
   }
+  return &(*pde)[pt_no(vaddr)];
 }
 
 /* Returns the supplementary page table entry corresponding to the page vaddr
-   in hash if it exists, or null otherwise */
-struct supp_page * supp_page_table_get(struct hash *hash, void *vaddr)
+   in spt if it exists, or null otherwise */
+struct supp_page * supp_page_table_get(struct supp_page_table *spt,
+    void *vaddr)
 {
-  struct supp_page entry;
-  entry.vaddr = vaddr;
-  struct hash_elem *found = hash_find(hash, &entry.hash_elem);
-  return found == NULL ? NULL : hash_entry(found, struct supp_page,
-      hash_elem);
+  if (!is_user_vaddr(vaddr)) {
+    return NULL;
+  }
+  struct supp_page **slot = lookup_slot(spt, vaddr, false);
+  return slot == NULL ? NULL : *slot;
 }
 
-/* Inserts the page vaddr into the supplemtary page table unless an entry for it
-   already exists, in which case it sets its status. */
-void supp_page_table_insert(struct hash *hash, void *vaddr,
+/* Inserts the writable, anonymous page vaddr into the supplemtary page table
+   unless an entry for it already exists, in which case it sets its status. */
+void supp_page_table_insert(struct supp_page_table *spt, void *vaddr,
                             enum page_status_t status)
 {
-  ASSERT(hash != NULL);
+  supp_page_table_add(spt, vaddr, status);
+}
+
+/* As supp_page_table_insert(), for a page whose first read_bytes bytes are
+   read in from file at offset ofs. */
+void supp_page_table_insert_file(struct supp_page_table *spt, void *vaddr,
+    enum page_status_t status, struct file *file, off_t ofs,
+    uint32_t read_bytes, bool writable)
+{
+  ASSERT(read_bytes <= PGSIZE);
+  struct supp_page *entry = supp_page_table_add(spt, vaddr, status);
+  entry->file = file;
+  entry->ofs = ofs;
+  entry->read_bytes = read_bytes;
+  entry->writable = writable;
+}
+
+/* Returns the entry for vaddr in spt with its status set to status, adding a
+   new writable, anonymous entry if there is none. */
+static struct supp_page * supp_page_table_add(struct supp_page_table *spt,
+    void *vaddr, enum page_status_t status)
+{
+  ASSERT(spt != NULL);
+  struct supp_page **slot = lookup_slot(spt, vaddr, true);
+  if (*slot != NULL) {
+    /* there was already an entry, mark it with status */
+    (*slot)->status = status;
+    return *slot;
+  }
+
   struct supp_page *entry = malloc(sizeof(struct supp_page));
   ASSERT(entry != NULL);
   entry->vaddr = pg_round_down(vaddr);
   entry->status = status;
-  struct hash_elem *prev = hash_insert(hash, &entry->hash_elem);
-  if (prev != NULL) {
-    /* there was already an entry, mark it with status */
-    hash_entry(prev, struct supp_page, hash_elem)->status = status;
-  }
+  entry->writable = true;
+  entry->swap_slot = BITMAP_ERROR;
+  entry->file = NULL;
+  entry->ofs = 0;
+  entry->read_bytes = 0;
+  *slot = entry;
+  return entry;
 }
 
 /* Remove and free the entry in the supplementary page table for vaddr. */
-void supp_page_table_remove(struct hash *hash, void *vaddr)
+void supp_page_table_remove(struct supp_page_table *spt, void *vaddr)
 {
-  struct supp_page page;
-  page.vaddr = vaddr;
-  struct hash_elem *found = hash_delete(hash, &page.hash_elem);
-  if (found == NULL) {
+  struct supp_page **slot = lookup_slot(spt, vaddr, false);
+  if (slot == NULL || *slot == NULL) {
     PANIC("Deleting non-existent item from spt!\n");
   }
-  delete_supp_pte(found, NULL);
+  free(*slot);
+  *slot = NULL;
 }
 
-/* function for hashing the page pointer in a supplementary page table entry */
-static unsigned supp_pte_hash_func(const struct hash_elem *elem,
-    void *aux UNUSED)
-{
-  struct supp_page *entry
-      = hash_entry(elem, struct supp_page, hash_elem);
-  return hash_bytes(&entry->vaddr, sizeof(entry->vaddr));
-}
-
-/* function for comparing the addresses of two supplemtary page table entries */
-static bool supp_pte_less_func(const struct hash_elem *a,
-    const struct hash_elem *b, void *aux UNUSED)
+/* Call action on every entry in spt for a page in [start, end), in order of
+   address.  Page tables with nothing in them are skipped over whole.  action
+   may remove the entry it is passed, but no other. */
+void supp_page_table_walk(struct supp_page_table *spt, void *start,
+    void *end, supp_page_action_func *action, void *aux)
 {
-  struct supp_page *a_entry
-      = hash_entry(a, struct supp_page, hash_elem);
-  struct supp_page *b_entry
-      = hash_entry(b, struct supp_page, hash_elem);
-  return a_entry->vaddr < b_entry->vaddr;
-}
+  ASSERT(start <= end && end <= PHYS_BASE);
+  if (spt->dir == NULL) {
+    return;
+  }
 
-/* Free the memory used by an entry in the supplementary page table */
-static void delete_supp_pte(struct hash_elem *elem, void *aux UNUSED)
-{
-  free(hash_entry(elem, struct supp_page, hash_elem));
+  uintptr_t vpn = pg_no(start);
+  uintptr_t end_vpn = pg_no(pg_round_up(end));
+  while (vpn < end_vpn) {
+    struct supp_page **table = spt->dir[vpn >> PTBITS];
+    if (table == NULL) {
+      /* Skip to the start of the next page table. */
+      vpn = (vpn | (SPT_TABLE_SIZE - 1)) + 1;
+      continue;
+    }
+    struct supp_page *entry = table[vpn & (SPT_TABLE_SIZE - 1)];
+    if (entry != NULL) {
+      action(entry, aux);
+    }
+    vpn++;
+  }
 }
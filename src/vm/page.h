@@ -1,28 +1,58 @@
 #ifndef VM_PAGE_H
 #define VM_PAGE_H
 
-#include <hash.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "vm/swap.h"
 
 /* The status of a page */
 enum page_status_t {
-  LOADED,     /* Loaded in memory */
-  MMAPPED,    /* Memory mapped and stored in the mmap table */
+  LOADED,     /* Loaded in memory, goes to swap when evicted */
+  MMAPPED,    /* Backed by a memory mapped file, written back when evicted */
+  EXECUTABLE, /* Read in from the executable; goes to swap once written to */
   SWAPPED,    /* Swapped out to disk */
   ZEROED,     /* Zeroed out page */
+  EVICTING,   /* Being written out of its frame by frame_evict() */
 };
 
+/* Everything needed to bring a user page into memory and to get rid of it
+   again.  file, ofs and read_bytes are only meaningful for MMAPPED and
+   EXECUTABLE pages.  swap_slot is BITMAP_ERROR unless the page is SWAPPED,
+   or the page cleaner has already copied it to swap while it was loaded. */
 struct supp_page {
   void *vaddr;                /* The virtual address of this page */
   enum page_status_t status;  /* The status of this page */
-  struct hash_elem hash_elem; /* Bookkeeping */
+  bool writable;              /* Whether the user may write to the page */
+  swap_index_t swap_slot;     /* Swap slot holding the page */
+  struct file *file;          /* File the page is read from */
+  off_t ofs;                  /* Offset of the start of the page in file */
+  uint32_t read_bytes;        /* Bytes of the page that come from file; the
+                                 rest are zeroed */
 };
 
-bool supp_page_table_init(struct hash *table);
-void supp_page_table_destroy(struct hash *table);
-struct supp_page * supp_page_table_get(struct hash *hash,
+/* A supplementary page table is laid out like the x86 page directory: a
+   directory indexed by pd_no() of page tables indexed by pt_no(), each slot
+   pointing to the entry for one user page.  Tables are only allocated for
+   the parts of the address space that are in use. */
+struct supp_page_table {
+  struct supp_page ***dir;    /* Page directory, or null if no pages */
+};
+
+/* Function called on each entry by supp_page_table_walk(). */
+typedef void supp_page_action_func(struct supp_page *page, void *aux);
+
+void supp_page_table_init(struct supp_page_table *spt);
+void supp_page_table_destroy(struct supp_page_table *spt);
+struct supp_page * supp_page_table_get(struct supp_page_table *spt,
     void *vaddr);
-void supp_page_table_insert(struct hash *hash, void *vaddr,
+void supp_page_table_insert(struct supp_page_table *spt, void *vaddr,
                             enum page_status_t);
-void supp_page_table_remove(struct hash *hash, void *vaddr);
+void supp_page_table_insert_file(struct supp_page_table *spt, void *vaddr,
+    enum page_status_t status, struct file *file, off_t ofs,
+    uint32_t read_bytes, bool writable);
+void supp_page_table_remove(struct supp_page_table *spt, void *vaddr);
+void supp_page_table_walk(struct supp_page_table *spt, void *start,
+    void *end, supp_page_action_func *action, void *aux);
 
 #endif /* vm/page.h */
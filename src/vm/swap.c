@@ -1,16 +1,13 @@
 #include "vm/swap.h"
 #include <bitmap.h>
+#include <stdio.h>
 #include "devices/block.h"
 #include "threads/vaddr.h"
-#include "threads/malloc.h"
 #include "threads/thread.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
+#include "vm/page.h"
 
-/* Functions required to use hash table */
-static unsigned swap_table_hash_func(const struct hash_elem *elem,
-    void *aux UNUSED);
-static bool swap_table_less_func(const struct hash_elem *a,
-    const struct hash_elem *b, void *aux UNUSED);
-static void delete_swap_table_entry(struct hash_elem *elem, void *aux UNUSED);
 static swap_index_t allocate_slot(void);
 
 static struct block *swap_dev;     /* The swap device */
@@ -18,7 +15,27 @@ static struct block *swap_dev;     /* The swap device */
 static const int sectors_per_page = PGSIZE / BLOCK_SECTOR_SIZE;
 static size_t num_slots;           /* Total number of swap slots */
 static struct bitmap *slot_usage;  /* Bitmap to represent usage of slots */
-struct lock swap_lock;
+/* Protects slot_usage.  It is not held while a page is read or written, so
+   swap I/O from different threads overlaps. */
+static struct lock swap_lock;
+
+/* Slots are handed out in clusters of adjacent slots, so that pages evicted
+   one after another end up next to each other on disk and can be read back
+   in sequence. */
+#define SWAP_CLUSTER_SLOTS 16
+static swap_index_t cluster_next;  /* Next slot to try in current cluster */
+static swap_index_t cluster_end;   /* End of current cluster */
+
+/* When a swapped out page is faulted in, up to readahead_window of the pages
+   after it are brought in as well, provided they sit in the following swap
+   slots.  The window grows while read-ahead pages get used and shrinks when
+   they are evicted untouched. */
+#define READAHEAD_MAX 8
+static size_t readahead_window = READAHEAD_MAX / 2;
+static struct lock readahead_lock;     /* Protects the window and counters */
+static long long readahead_cnt;        /* Pages read ahead */
+static long long readahead_hit_cnt;    /* ...that were used */
+static long long readahead_miss_cnt;   /* ...that were evicted unused */
 
 /* Initialise the swap system */
 void swap_init(void)
@@ -27,6 +44,7 @@ void swap_init(void)
   num_slots = block_size(swap_dev) / sectors_per_page;
   slot_usage = bitmap_create(num_slots);
   lock_init(&swap_lock);
+  lock_init(&readahead_lock);
 }
 
 /* Deinitialise the swap system */
@@ -35,129 +53,155 @@ void swap_destroy(void)
   bitmap_destroy(slot_usage);
 }
 
-/* Initialise a swap table */
-void swap_table_init(struct hash *table)
+/* Allocate a swap slot and mark it as in use, preferring the slot after the
+   one handed out last.  Must be called with the swap lock held.
+   Returns BITMAP_ERROR if there is no available swap */
+static swap_index_t allocate_slot(void)
 {
-  hash_init(table, swap_table_hash_func, swap_table_less_func, NULL);
-}
+  /* Carry on through the current cluster. */
+  while (cluster_next < cluster_end) {
+    swap_index_t slot = cluster_next++;
+    if (!bitmap_test(slot_usage, slot)) {
+      bitmap_mark(slot_usage, slot);
+      return slot;
+    }
+  }
 
-/* Destroy a swap table */
-void swap_table_destroy(struct hash *table)
-{
-  hash_destroy(table, &delete_swap_table_entry);
-}
+  /* Start a new cluster at the next run of free slots, wrapping round to the
+     start of the device if need be. */
+  size_t start = cluster_end < num_slots ? cluster_end : 0;
+  swap_index_t slot = bitmap_scan(slot_usage, start, SWAP_CLUSTER_SLOTS, false);
+  if (slot == BITMAP_ERROR && start != 0) {
+    slot = bitmap_scan(slot_usage, 0, SWAP_CLUSTER_SLOTS, false);
+  }
+  if (slot != BITMAP_ERROR) {
+    cluster_next = slot + 1;
+    cluster_end = slot + SWAP_CLUSTER_SLOTS;
+    bitmap_mark(slot_usage, slot);
+    return slot;
+  }
 
-/* Use vaddr as the key, and just call hash_bytes on it */
-static unsigned swap_table_hash_func(const struct hash_elem *elem,
-    void *aux UNUSED)
-{
-  struct swap_table_entry *entry
-      = hash_entry(elem, struct swap_table_entry, elem);
-  return hash_bytes(&entry->vaddr, sizeof(entry->vaddr));
+  /* Swap is too fragmented for a whole cluster, so take any free slot. */
+  cluster_next = cluster_end = 0;
+  return bitmap_scan_and_flip_next(slot_usage, 1, false);
 }
 
-/* Use vaddr as the key and just compare those */
-static bool swap_table_less_func(const struct hash_elem *a,
-    const struct hash_elem *b, void *aux UNUSED)
+/* Read the page in swap slot slot into the frame at kaddr, and free the
+   slot. */
+void swap_into_memory(swap_index_t slot, void *kaddr)
 {
-    struct swap_table_entry *a_entry
-        = hash_entry(a, struct swap_table_entry, elem);
-    struct swap_table_entry *b_entry
-        = hash_entry(b, struct swap_table_entry, elem);
-    return a_entry->vaddr < b_entry->vaddr;
-}
+  ASSERT(is_kernel_vaddr(kaddr));
 
-/* Deallocate memory for a swap table entry */
-static void delete_swap_table_entry(struct hash_elem *elem, void *aux UNUSED)
-{
-  struct swap_table_entry *e = hash_entry(elem, struct swap_table_entry, elem);
-  bitmap_reset(slot_usage, e->index);
-  free(e);
-}
+  lock_acquire(&swap_lock);
+  /* check that there's actually a page at swap index slot */
+  ASSERT(bitmap_test(slot_usage, slot));
+  lock_release(&swap_lock);
 
-/* Allocate a swap slot and mark it as in use.
-   Returns BITMAP_ERROR if there is no available swap */
-static swap_index_t allocate_slot(void)
-{
-  /* Scan the entire bitmap for an unmarked slot and mark it. */
-  return bitmap_scan_and_flip(slot_usage, 0, 1, false);
+  block_read_multiple(swap_dev, slot * sectors_per_page, kaddr,
+      sectors_per_page);
+  swap_free(slot);
 }
 
-/* Moves the swap block for vaddr in the swap table into a frame given by kaddr.
-   Returns false if the swap table entry for vaddr could not be found, or true
-   if the operation succeeded. */
-bool swap_into_memory(struct hash *table, void *vaddr, void *kaddr)
+/* Write the frame at kaddr to a free swap slot, and return the slot.
+   Panics the kernel if we're out of swap space */
+swap_index_t swap_to_disk(void *kaddr)
 {
-  /* check that kaddr and vaddr are valid. */
   ASSERT(is_kernel_vaddr(kaddr));
-  ASSERT(is_user_vaddr(vaddr));
 
   lock_acquire(&swap_lock);
-
-  /* Find the entry for vaddr in the swap table. */
-  struct swap_table_entry search_entry;
-  search_entry.vaddr = vaddr;
-  struct hash_elem *found = hash_find(table, &search_entry.elem);
-
-  if (found == NULL) {
-    return false;
-  }
-
-  swap_index_t index = hash_entry(found, struct swap_table_entry, elem)->index;
-  /* check that there's actually a page at swap index found in table */
-  ASSERT(bitmap_test(slot_usage, index));
-
-  /* Read the slot into the frame */
-  for (int i = 0; i < sectors_per_page; i++) {
-    block_read(swap_dev, (index * sectors_per_page + i),
-        kaddr + BLOCK_SECTOR_SIZE * i);
-  }
-
-  /* Clean up */
-  struct hash_elem *elem = hash_delete(table, found);
-  if (elem != NULL) {
-    delete_swap_table_entry(found, NULL);
+  swap_index_t slot = allocate_slot();
+  if (slot == BITMAP_ERROR) {
+    /* Out of swap space */
+    PANIC("Oh dear, we've run out of swap space.");
   }
-  bitmap_reset(slot_usage, index);
-
   lock_release(&swap_lock);
 
-  return true;
+  /* Write out to disk at the allocated index */
+  block_write_multiple(swap_dev, slot * sectors_per_page, kaddr,
+      sectors_per_page);
+  return slot;
 }
 
-/* Swap to disk the frame at kaddr, (representing user address vaddr), and
-   record this in the swap table passed.
-   Panics the kernel if we're out of swap space */
-void swap_to_disk(struct hash *table, void *vaddr, void *kaddr)
+/* Write the frame at kaddr over swap slot slot, which must be in use. */
+void swap_write(swap_index_t slot, void *kaddr)
 {
-  /* check that kaddr and vaddr are valid */
   ASSERT(is_kernel_vaddr(kaddr));
-  ASSERT(is_user_vaddr(vaddr));
+  ASSERT(slot < num_slots);
+
+  block_write_multiple(swap_dev, slot * sectors_per_page, kaddr,
+      sectors_per_page);
+}
 
+/* Give up swap slot slot without reading it. */
+void swap_free(swap_index_t slot)
+{
   lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(slot_usage, slot));
+  bitmap_reset(slot_usage, slot);
+  lock_release(&swap_lock);
+}
 
-  swap_index_t slot_index = allocate_slot();
-  if (slot_index == BITMAP_ERROR) {
-    /* Out of swap space */
-    PANIC("Oh dear, we've run out of swap space.");
+/* Having just faulted in the current thread's page vaddr from swap slot
+   slot, bring in the pages following vaddr too, for as long as they are
+   swapped out to the following slots.  Stops early rather than evict
+   anything to make room. */
+void swap_read_ahead(void *vaddr, swap_index_t slot)
+{
+  struct thread *t = thread_current();
+
+  lock_acquire(&readahead_lock);
+  size_t window = readahead_window;
+  lock_release(&readahead_lock);
+
+  for (size_t i = 1; i <= window; i++) {
+    void *upage = vaddr + i * PGSIZE;
+    if (!is_user_vaddr(upage)) {
+      break;
+    }
+    struct supp_page *sp = supp_page_table_get(&t->supp_page_table, upage);
+    if (sp == NULL || sp->status != SWAPPED || sp->swap_slot != slot + i) {
+      break;
+    }
+
+    void *kaddr = frame_get_readahead_page(upage);
+    if (kaddr == NULL) {
+      break;
+    }
+    swap_into_memory(sp->swap_slot, kaddr);
+    sp->swap_slot = BITMAP_ERROR;
+    sp->status = LOADED;
+    install_page(upage, kaddr, sp->writable);
+    frame_unpin(kaddr);
+
+    lock_acquire(&readahead_lock);
+    readahead_cnt++;
+    lock_release(&readahead_lock);
   }
+}
 
-  /* Write out to disk at the allocated index */
-  for (int i = 0; i < sectors_per_page; i++) {
-    block_write(swap_dev, (slot_index * sectors_per_page + i),
-        kaddr + BLOCK_SECTOR_SIZE * i);
+/* Record whether a page that was read ahead was used before it was evicted
+   or freed, and adjust the read-ahead window to match. */
+void swap_readahead_feedback(bool hit)
+{
+  lock_acquire(&readahead_lock);
+  if (hit) {
+    readahead_hit_cnt++;
+    if (readahead_window < READAHEAD_MAX) {
+      readahead_window++;
+    }
+  } else {
+    readahead_miss_cnt++;
+    if (readahead_window > 1) {
+      readahead_window /= 2;
+    }
   }
+  lock_release(&readahead_lock);
+}
 
-  /* Make a swap table entry and add it to the swap table */
-  struct swap_table_entry *entry
-      = (struct swap_table_entry *) malloc(sizeof(struct swap_table_entry));
-  ASSERT(entry != NULL);
-  entry->vaddr = vaddr;
-  entry->index = slot_index;
-  /* If hash_insert returned non-null, there was already an entry in the swap
-     table for that page. */
-  struct hash_elem* inserted = hash_insert(table, &entry->elem);
-  ASSERT(inserted == NULL);
-
-  lock_release(&swap_lock);
+/* Prints swap read-ahead statistics. */
+void swap_print_stats(void)
+{
+  printf("Swap: %lld pages read ahead, %lld hits, %lld misses, "
+         "window %zu\n", readahead_cnt, readahead_hit_cnt, readahead_miss_cnt,
+         readahead_window);
 }